@@ -0,0 +1,391 @@
+// The timed search (ab-timed.cpp) again, with each node a C++20 coroutine
+// that co_awaits its children instead of counting their callbacks. The
+// children run on the timed search's thread pool, and whichever finishes
+// last resumes the parent on its own thread, by symmetric transfer. The
+// frames come from a pool that belongs to the search, which reuses them,
+// and frees them all when the search ends.
+//
+// What each node does is the timed search's own code, in move_expansion.h
+// and chance_expansion.h; only the scheduling is different. It follows
+// the timed search's rules, down to the stop flag, but it has no node
+// budget, doesn't order moves by their priors (set_move_priors), and
+// doesn't cap its live nodes (set_max_live_nodes); main-tests.cpp checks
+// that it ignores the last two.
+//
+// This is the only file built as C++20; it shares nothing with the rest
+// but the Engine interface and the headers, which are C++14.
+
+#include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "ab-timed.h"
+#include "chance_expansion.h"
+#include "engine.h"
+#include "move_expansion.h"
+#include "move_ordering.h"
+#include "opening_book.h"
+#include "state.h"
+#include "threat_search.h"
+
+#define FRAME_POOL_LANES 8
+
+using Clock = std::chrono::steady_clock;
+using Deadline = Clock::time_point;
+using Result = std::pair<double, int>;
+
+// Coroutine frames come in only a few sizes, so freed ones are kept on
+// per-size lists for reuse. Threads take frames from different lanes,
+// to keep them off each other's locks; a frame goes back to the lane of
+// whichever thread frees it.
+class FramePool {
+public:
+    void *allocate(size_t n) {
+        n = round_up(n);
+        Lane& lane = my_lane();
+        std::lock_guard<std::mutex> lk(lane.mtx_);
+        for (auto&& list : lane.free_) {
+            if (list.first == n && !list.second.empty()) {
+                void *p = list.second.back();
+                list.second.pop_back();
+                return p;
+            }
+        }
+        if (lane.end_ - lane.next_ < ptrdiff_t(n)) {
+            size_t size = std::max(chunk_size, n);
+            lane.chunks_.push_back(std::make_unique<char[]>(size));
+            lane.next_ = lane.chunks_.back().get();
+            lane.end_ = lane.next_ + size;
+        }
+        void *p = lane.next_;
+        lane.next_ += n;
+        return p;
+    }
+
+    void deallocate(void *p, size_t n) {
+        n = round_up(n);
+        Lane& lane = my_lane();
+        std::lock_guard<std::mutex> lk(lane.mtx_);
+        for (auto&& list : lane.free_) {
+            if (list.first == n) {
+                list.second.push_back(p);
+                return;
+            }
+        }
+        lane.free_.emplace_back(n, std::vector<void*>{p});
+    }
+
+private:
+    static constexpr size_t chunk_size = 64 * 1024;
+
+    struct Lane {
+        std::mutex mtx_;
+        std::vector<std::unique_ptr<char[]>> chunks_;
+        char *next_ = nullptr;
+        char *end_ = nullptr;
+        std::vector<std::pair<size_t, std::vector<void*>>> free_;
+    };
+
+    static size_t round_up(size_t n) {
+        return (n + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+    }
+
+    Lane& my_lane() {
+        static std::atomic<int> next_lane {0};
+        static thread_local int lane = next_lane++ % FRAME_POOL_LANES;
+        return lanes_[lane];
+    }
+
+    Lane lanes_[FRAME_POOL_LANES];
+};
+
+struct CoroSearch {
+    LeafEvaluationFunction eval_;
+    Deadline deadline_;
+    int max_depth_ = INT_MAX;  // counted in nodes, i.e. two per ply
+    bool deterministic_ = false;
+    std::atomic<long> nodes_ {0};
+    std::atomic<int> depth_reached_ {0};
+    FramePool frames_;
+
+    explicit CoroSearch(LeafEvaluationFunction e, Deadline d) : eval_(e), deadline_(d) {}
+
+    bool is_out_of_time() const {
+        return is_stop_requested() || (!deterministic_ && Clock::now() >= deadline_);
+    }
+
+    void reached(int depth) {
+        int d = depth_reached_.load();
+        while (d < depth && !depth_reached_.compare_exchange_weak(d, depth)) {
+            // go around again
+        }
+    }
+};
+
+// The thread that starts a search waits on this for the root to finish.
+struct Done {
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    bool done_ = false;
+
+    void set() {
+        // Notify under the lock, so the waiter can't destroy us in between.
+        std::lock_guard<std::mutex> lk(mtx_);
+        done_ = true;
+        cv_.notify_all();
+    }
+    void wait() {
+        std::unique_lock<std::mutex> lk(mtx_);
+        cv_.wait(lk, [&] { return done_; });
+    }
+};
+
+// What a parent waits on: its children's count, and itself to resume.
+// The root's parent is a plain thread, waiting on done_ instead.
+struct Join {
+    std::atomic<int> remaining_ {0};
+    std::coroutine_handle<> parent_;
+    Done *done_ = nullptr;
+};
+
+// A search node, created suspended; its parent starts it.
+class Node {
+public:
+    struct promise_type;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(Handle h) noexcept {
+            Join *join = h.promise().join_;
+            if (join->remaining_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+                return std::noop_coroutine();
+            } else if (join->parent_) {
+                return join->parent_;
+            }
+            join->done_->set();
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    struct promise_type {
+        Result result_ = { INT_MIN, 0 };
+        Join *join_ = nullptr;
+
+        // Every node's first parameter is its search, whose pool the frame
+        // comes from; the frame remembers the pool in a header.
+        static constexpr size_t header = alignof(std::max_align_t);
+        template<class... Args>
+        static void *operator new(size_t n, CoroSearch& search, Args&&...) {
+            char *p = static_cast<char*>(search.frames_.allocate(header + n));
+            *reinterpret_cast<FramePool**>(p) = &search.frames_;
+            return p + header;
+        }
+        static void operator delete(void *p, size_t n) {
+            char *base = static_cast<char*>(p) - header;
+            (*reinterpret_cast<FramePool**>(base))->deallocate(base, header + n);
+        }
+
+        Node get_return_object() { return Node(Handle::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void return_value(Result r) { result_ = r; }
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    Node(Node&& rhs) noexcept : h_(std::exchange(rhs.h_, nullptr)) {}
+    Node& operator=(Node&&) = delete;
+    ~Node() { if (h_) h_.destroy(); }
+
+    const Result& result() const { return h_.promise().result_; }
+    Handle handle() const { return h_; }
+
+private:
+    explicit Node(Handle h) : h_(h) {}
+    Handle h_;
+};
+
+// co_await all_of(children) runs them all and resumes when the last is
+// done. Depth-first, the parent runs its first child itself, and only the
+// rest go through the queue. Under a deadline, they're all queued, in one
+// batch, and the tree grows breadth-first, as the timed search's does, so
+// that a deadline doesn't find one line searched deep and the rest not at
+// all. (Running even a few children inline would skew it that way.)
+struct AllOf {
+    std::vector<Node>& children_;
+    bool depth_first_;
+    Join join_;
+
+    bool await_ready() { return children_.empty(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> parent) {
+        size_t n = children_.size();
+        join_.remaining_ = n;
+        join_.parent_ = parent;
+        for (auto&& c : children_) {
+            c.handle().promise().join_ = &join_;
+        }
+        // Once the last child is queued, the parent may be resumed, and
+        // even finished, on another thread; so touch nothing after that.
+        // The count includes a first child run here, so it can't be.
+        std::coroutine_handle<> first = std::noop_coroutine();
+        if (depth_first_) {
+            first = children_[0].handle();
+        }
+        std::vector<std::function<void()>> rest;
+        rest.reserve(n);
+        for (size_t i = (depth_first_ ? 1 : 0); i < n; ++i) {
+            rest.push_back([h = children_[i].handle()] { h.resume(); });
+        }
+        if (!rest.empty()) {
+            schedule_search_tasks(std::move(rest));
+        }
+        return first;
+    }
+    void await_resume() {}
+};
+
+static AllOf all_of(std::vector<Node>& children, bool depth_first)
+{
+    return AllOf{children, depth_first, {}};
+}
+
+static Node expect_card(CoroSearch& search, State s, int depth, int move, std::atomic<bool> *sibling_won);
+
+// A child of expect_card() has the threat it faces and its moves worked
+// out already, in the parent's ChanceExpansion; the root has neither.
+static Node pick_move(CoroSearch& search, State s, int depth, const Board::ForcedMove *threat, const ChanceExpansion::Shared *shared)
+{
+    search.nodes_.fetch_add(1, std::memory_order_relaxed);
+    if (s.is_tie_game()) {
+        co_return Result{ search.eval_(s), 0 };
+    }
+    // As in the timed search, the first ply is always searched.
+    if (depth >= search.max_depth_ || (depth > 0 && search.is_out_of_time())) {
+        co_return Result{ search.eval_(s), 0 };
+    }
+
+    MoveExpansion node(s, depth, threat, shared);
+    Result r;
+    if (node.is_settled(&r)) {
+        co_return r;
+    }
+    std::atomic<bool> won {false};
+    std::vector<Node> children;
+    children.reserve(node.count());
+    auto add_child = [&](int m, const State& next) {
+        children.push_back(expect_card(search, next, depth+1, m, &won));
+    };
+    if (node.expand([](int) { return true; }, add_child, &r)) {
+        co_return r;
+    }
+    co_await all_of(children, search.deterministic_);
+
+    // This may be another thread, now; combine() uses its move ordering.
+    search.reached(depth);
+    co_return MoveExpansion::combine(s, depth, children.size(), [&](int i) { return children[i].result(); });
+}
+
+static Node expect_card(CoroSearch& search, State s, int depth, int move, std::atomic<bool> *sibling_won)
+{
+    search.nodes_.fetch_add(1, std::memory_order_relaxed);
+    if (sibling_won->load(std::memory_order_relaxed)) {
+        // The parent already has a winning move; its value is moot.
+        co_return Result{ INT_MIN, move };
+    }
+    if (depth > 1 && search.is_out_of_time()) {
+        co_return Result{ search.eval_(s), move };
+    }
+    ChanceExpansion node(s);
+    const bool is_leaf = s.is_tie_game() || depth+1 >= search.max_depth_;
+    // Only the draws that have to be searched get a child.
+    double values[GameRules::max_value];
+    int child_draws[GameRules::max_value];
+    std::vector<Node> children;
+    int settled = node.expand_children(depth+1, is_leaf, search.eval_, values, [&](int i, const ChanceExpansion::Draw& d) {
+        child_draws[children.size()] = i;
+        children.push_back(pick_move(search, node.after(d), depth+1, &d.threat, &node.shared()));
+    });
+    search.nodes_.fetch_add(settled, std::memory_order_relaxed);
+    co_await all_of(children, search.deterministic_);
+
+    search.reached(depth);
+    for (size_t i=0; i < children.size(); ++i) {
+        values[child_draws[i]] = children[i].result().first;
+    }
+    double value = node.combine([&](int i) { return values[i]; });
+    if (value >= double(INT_MAX) && !search.deterministic_) {
+        // Siblings that haven't started yet needn't bother.
+        sibling_won->store(true, std::memory_order_relaxed);
+    }
+    co_return Result{ value, move };
+}
+
+static Result run_search(CoroSearch& search, const State& s, SearchStats *stats)
+{
+    Done done;
+    Join join;
+    join.remaining_ = 1;
+    join.done_ = &done;
+    Result r;
+    {
+        Node root = pick_move(search, s, 0, nullptr, nullptr);
+        root.handle().promise().join_ = &join;
+        root.handle().resume();
+        done.wait();
+        r = root.result();
+    }
+    if (stats != nullptr) {
+        stats->nodes += search.nodes_;
+        stats->depth = std::max(stats->depth, (search.depth_reached_ + 1) / 2);
+    }
+    return r;
+}
+
+// Deterministic to a depth alone, as the timed engine is; otherwise it
+// stops at the deadline. It has no node budget.
+class CoroutineEngine : public Engine {
+public:
+    explicit CoroutineEngine(LeafEvaluationFunction eval) : eval_(eval) {}
+
+    bool supports(const SearchLimits& limits) const override {
+        return limits.nodes == 0;
+    }
+
+    SearchResult search(const State& s, const SearchLimits& limits) const override {
+        assert(supports(limits));
+        SearchResult result;
+        Result vm;
+        if (limits.plies == 0 && find_book_move(s, &vm)) {
+            // as recursively_evaluate() does
+        } else if (ProvenWin win = prove_forced_win(s); win.is_proven) {
+            vm = { INT_MAX, win.move };
+        } else {
+            Deadline deadline = (limits.time.count() > 0) ? Clock::now() + limits.time : Deadline::max();
+            CoroSearch search(eval_, deadline);
+            if (limits.plies > 0) {
+                search.max_depth_ = 2 * limits.plies;
+                search.deterministic_ = (limits.time.count() == 0);
+            }
+            vm = run_search(search, s, &result.stats);
+        }
+        result.value = vm.first;
+        result.move = vm.second;
+        return result;
+    }
+
+private:
+    LeafEvaluationFunction eval_;
+};
+
+static EngineRegistration coroutine_registration(
+    "coroutine", "the timed engine's search as C++20 coroutines; no node budget, priors or live cap",
+    [](LeafEvaluationFunction eval) -> std::unique_ptr<Engine> { return std::make_unique<CoroutineEngine>(eval); });
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
 #include <chrono>
@@ -5,13 +6,19 @@
 #include <future>
 #include <memory>
 #include <mutex>
+#include <random>
 #include <thread>
 #include <utility>
 #include <vector>
 #include "ab-timed.h"
+#include "chance_expansion.h"
+#include "move_expansion.h"
+#include "move_ordering.h"
+#include "opening_book.h"
 #include "state.h"
+#include "threat_search.h"
+#include "trace.h"
 
-#define LOOK_FOR_CHECKS 1
 #define NUM_THREADS 4
 
 double simplest_eval(const State& s)
@@ -19,6 +26,12 @@ double simplest_eval(const State& s)
     return (rand() % 2) ? 1 : -1;
 }
 
+double hashed_eval(const State& s)
+{
+    std::minstd_rand rand(std::hash<PackedState>()(s.toPackedCanonical().first));
+    return (rand() % 2) ? 1 : -1;
+}
+
 int recursively_scheduled_tasks = 0;
 int recursively_evaluated_tasks = 0;
 std::atomic<int> max_search_depth {0};
@@ -32,8 +45,9 @@ int fetch_and_decrement_if_positive(std::atomic<int>& x) {
     return expected;
 }
 
-int fetch_and_max(std::atomic<int>& x, int y) {
-    int expected = x.load();
+template<class T>
+T fetch_and_max(std::atomic<T>& x, T y) {
+    T expected = x.load();
     while ((expected < y) && !x.compare_exchange_weak(expected, y)) {
         // go around again
     }
@@ -52,8 +66,12 @@ struct WorkQueue {
             workers_.emplace_back([this]() {
                 std::unique_lock<std::mutex> lk(mtx_);
                 while (true) {
-                    while (tasks_.empty() && !stop_) {
-                        cv_.wait(lk);
+                    if (tasks_.empty() && !stop_) {
+                        TRACE_BEGIN("idle");
+                        while (tasks_.empty() && !stop_) {
+                            cv_.wait(lk);
+                        }
+                        TRACE_END("idle");
                     }
                     if (stop_) break;
                     assert(!tasks_.empty());
@@ -61,19 +79,45 @@ struct WorkQueue {
                     tasks_.pop_front();
                     recursively_evaluated_tasks += 1;
                     lk.unlock();
-                    f();
+                    {
+                        TRACE_SCOPE("run");
+                        f();
+                    }
+                    TRACE_BEGIN("queue lock");
                     lk.lock();
+                    TRACE_END("queue lock");
                 }
             });
         }
     }
     void schedule(std::function<void()> f) {
+        TRACE_INSTANT("schedule");
+        TRACE_BEGIN("queue lock");
         std::unique_lock<std::mutex> lk(mtx_);
+        TRACE_END("queue lock");
         recursively_scheduled_tasks += 1;
         tasks_.push_back(std::move(f));
         lk.unlock();
         cv_.notify_one();
     }
+    void schedule_all(std::vector<std::function<void()>> fs) {
+        TRACE_INSTANT("schedule");
+        TRACE_BEGIN("queue lock");
+        std::unique_lock<std::mutex> lk(mtx_);
+        TRACE_END("queue lock");
+        recursively_scheduled_tasks += fs.size();
+        for (auto& f : fs) {
+            tasks_.push_back(std::move(f));
+        }
+        lk.unlock();
+        if (fs.size() >= workers_.size()) {
+            cv_.notify_all();
+        } else {
+            for (size_t i=0; i < fs.size(); ++i) {
+                cv_.notify_one();
+            }
+        }
+    }
 
     ~WorkQueue() {
         stop_ = true;
@@ -84,7 +128,70 @@ struct WorkQueue {
     }
 };
 
-static WorkQueue g_workQueue(NUM_THREADS);
+static std::unique_ptr<WorkQueue> g_workQueue = std::make_unique<WorkQueue>(NUM_THREADS);
+
+static bool g_assume_opening_moves = true;
+
+void set_assume_opening_moves(bool assume)
+{
+    g_assume_opening_moves = assume;
+}
+
+bool assumes_opening_moves()
+{
+    return g_assume_opening_moves;
+}
+
+void schedule_search_task(std::function<void()> f)
+{
+    g_workQueue->schedule(std::move(f));
+}
+
+void schedule_search_tasks(std::vector<std::function<void()>> fs)
+{
+    g_workQueue->schedule_all(std::move(fs));
+}
+
+static long g_max_live_nodes = 1L << 20;
+
+void set_max_live_nodes(long n)
+{
+    assert(n == 0 || n >= 2);
+    g_max_live_nodes = n;
+}
+
+static const std::atomic<bool> *g_stop_flag = nullptr;
+
+void set_stop_flag(const std::atomic<bool> *stop)
+{
+    g_stop_flag = stop;
+}
+
+bool is_stop_requested()
+{
+    return g_stop_flag != nullptr && g_stop_flag->load(std::memory_order_relaxed);
+}
+
+static MovePriorFunction g_move_priors;
+static int g_move_prior_plies = 0;
+
+void set_move_priors(MovePriorFunction f, int max_plies)
+{
+    g_move_priors = std::move(f);
+    g_move_prior_plies = max_plies;
+}
+
+void set_search_threads(int n)
+{
+    assert(n >= 1);
+    g_workQueue = nullptr;  // join the old workers first
+    g_workQueue = std::make_unique<WorkQueue>(n);
+}
+
+int count_search_threads()
+{
+    return g_workQueue->workers_.size();
+}
 
 using Deadline = std::chrono::steady_clock::time_point;
 
@@ -101,118 +208,158 @@ struct Variant {
     B b;
 };
 
+struct SearchContext {
+    LeafEvaluationFunction eval_;
+    Deadline deadline_;
+    int max_depth_ = INT_MAX;  // counted in tasks, i.e. two per ply
+    bool deterministic_ = false;
+    long max_live_nodes_ = g_max_live_nodes;
+    long max_nodes_ = 0;  // if not 0, give up once this many nodes are searched
+    std::atomic<long> nodes_ {0};
+    std::atomic<long> live_nodes_ {0};
+    std::atomic<long> peak_live_nodes_ {0};
+    std::atomic<int> depth_reached_ {0};
+    std::atomic<bool> cut_short_ {false};
+    std::vector<int> root_moves_;  // if not empty, search only these moves at the root
+    const std::atomic<bool> *cancel_ = nullptr;  // like the stop flag, for this search alone
+
+    explicit SearchContext(LeafEvaluationFunction e, Deadline d) : eval_(e), deadline_(d) {}
+
+    bool is_out_of_time() {
+        if (is_stop_requested() || (cancel_ != nullptr && cancel_->load(std::memory_order_relaxed)) ||
+            (max_nodes_ != 0 && nodes_.load(std::memory_order_relaxed) >= max_nodes_) ||
+            (!deterministic_ && std::chrono::steady_clock::now() >= deadline_)) {
+            cut_short_ = true;
+            return true;
+        }
+        return false;
+    }
+
+    // Past the cap, a timed search stops expanding, and a deterministic
+    // one runs each new child inline, depth first, instead of queueing it.
+    bool is_over_live_cap() const {
+        return max_live_nodes_ != 0 && live_nodes_.load(std::memory_order_relaxed) >= max_live_nodes_;
+    }
+};
+
+// A task lives as long as it's queued or running or waiting for children;
+// children keep their parent alive, not the other way around, so a subtree
+// is freed as soon as its result has been folded into its parent's.
 struct Task : std::enable_shared_from_this<Task> {
-    Result result_ = { INT_MIN, 0 };
+    std::shared_ptr<SearchContext> ctx_;
+
+    explicit Task(std::shared_ptr<SearchContext> ctx) : ctx_(std::move(ctx)) {
+        long live = ctx_->live_nodes_.fetch_add(1, std::memory_order_relaxed) + 1;
+        fetch_and_max(ctx_->peak_live_nodes_, live);
+    }
 
     template<class Callable>
     void spawn_thread(Callable f) {
-        g_workQueue.schedule(f);
+        g_workQueue->schedule(f);
     }
 
-    void got_one_subresult() { do_got_one_subresult(); }
-    void got_awesome_subresult() { do_got_awesome_subresult(); }
-    void evaluate_and_notify() { do_evaluate_and_notify(); }
+    void dispatch(std::shared_ptr<Task> t) {
+        if (ctx_->deterministic_ && ctx_->is_over_live_cap()) {
+            t->evaluate_and_notify();
+        } else {
+            spawn_thread([t] { t->evaluate_and_notify(); });
+        }
+    }
 
-    virtual ~Task() = default;
+    // The value of the child in `slot`.
+    void got_one_subresult(int slot, double v) { do_got_one_subresult(slot, v); }
+    void evaluate_and_notify() {
+        TRACE_SCOPE("evaluate");
+        ctx_->nodes_.fetch_add(1, std::memory_order_relaxed);
+        do_evaluate_and_notify();
+    }
+
+    virtual ~Task() {
+        ctx_->live_nodes_.fetch_sub(1, std::memory_order_relaxed);
+    }
 
 private:
-    virtual void do_got_one_subresult() = 0;
-    virtual void do_got_awesome_subresult() = 0;
+    virtual void do_got_one_subresult(int slot, double v) = 0;
     virtual void do_evaluate_and_notify() = 0;
 };
 
 struct ExpectCardTask : Task {
     int depth_;
-    LeafEvaluationFunction eval_;
     State s_;
     std::atomic<int> waiting_for_subresults_ {0};
-    std::weak_ptr<Task> parent_task_;
-    std::vector<std::shared_ptr<Task>> subtasks_;
-    std::vector<int> weights_;
-    Deadline deadline_;
+    std::shared_ptr<Task> parent_task_;
+    int slot_;  // in the parent
+    std::unique_ptr<ChanceExpansion> node_;
+    double values_[GameRules::max_value];  // by draw
 
-    explicit ExpectCardTask(int depth, std::shared_ptr<Task> parent, LeafEvaluationFunction e, State s, int move, Deadline d) :
-        depth_(depth), eval_(e), s_(s), parent_task_(parent), deadline_(d) {
-        result_.second = move;
-    }
+    explicit ExpectCardTask(int depth, std::shared_ptr<Task> parent, int slot, std::shared_ptr<SearchContext> ctx, State s) :
+        Task(std::move(ctx)), depth_(depth), s_(s), parent_task_(std::move(parent)), slot_(slot) {}
 
 private:
-    void do_got_awesome_subresult() override {
-        assert(false);
-    }
-
-    void do_got_one_subresult() override {
+    void do_got_one_subresult(int slot, double v) override {
+        values_[slot] = v;
         if (fetch_and_decrement_if_positive(waiting_for_subresults_) == 1) {
             combine_subresults();
         }
     }
 
     void set_and_notify(double v) {
-        this->result_.first = v;
-        if (auto p = parent_task_.lock()) {
-            if (v >= double(INT_MAX)) {
-                p->got_awesome_subresult();
-            } else {
-                p->got_one_subresult();
-            }
-        }
+        TRACE_INSTANT("notify");
+        parent_task_->got_one_subresult(slot_, v);
+        parent_task_ = nullptr;
     }
 
     void do_evaluate_and_notify() override;
 
     void combine_subresults() {
+        TRACE_SCOPE("combine");
         fetch_and_max(max_search_depth, depth_);
+        fetch_and_max(ctx_->depth_reached_, depth_);
         assert(waiting_for_subresults_ <= 0);
-        double sum = 0;
-        int count = 0;
-        assert(subtasks_.size() == weights_.size());
-        auto is_his_win = [](const auto& p) { return p->result_.first >= double(INT_MAX-1); };
-        auto is_his_loss = [](const auto& p) { return p->result_.first <= double(INT_MIN+1); };
-        if (std::all_of(subtasks_.begin(), subtasks_.end(), is_his_loss)) {
-            return set_and_notify(INT_MAX);
-        }
-        double ceiling = std::any_of(subtasks_.begin(), subtasks_.end(), is_his_win) ? 20 : INT_MAX;
-        for (int i=0; i < subtasks_.size(); ++i) {
-            sum += std::min(subtasks_[i]->result_.first, ceiling);
-            count += weights_[i];
-        }
-        return set_and_notify(-sum / count);
+        return set_and_notify(node_->combine([&](int i) { return values_[i]; }));
     }
 };
 
 struct PickMoveTask : Task {
     int depth_;
-    LeafEvaluationFunction eval_;
     State s_;
     std::atomic<int> waiting_for_subresults_ {0};
-    Variant<std::weak_ptr<Task>, std::promise<Result>> parent_task_;
-    std::vector<std::shared_ptr<Task>> subtasks_;
-    Deadline deadline_;
+    Variant<std::shared_ptr<Task>, std::promise<Result>> parent_task_;
+    int slot_ = 0;  // in the parent
+    int n_children_ = 0;
+    std::atomic<double> values_[GameRules::max_moves];  // by child; INT_MIN until it's done
+    int moves_[GameRules::max_moves];
 
-    explicit PickMoveTask(int depth, std::shared_ptr<Task> parent, LeafEvaluationFunction e, State s, Deadline d) :
-        depth_(depth), eval_(e), s_(s), parent_task_(std::weak_ptr<Task>(parent)), deadline_(d) {}
+    bool is_prepared_ = false;  // by the parent's ChanceExpansion
+    Board::ForcedMove threat_;
+    ChanceExpansion::Shared shared_;
 
-    explicit PickMoveTask(std::promise<Result> parent, LeafEvaluationFunction e, State s, Deadline d) :
-        depth_(0), eval_(e), s_(s), parent_task_(std::move(parent)), deadline_(d) {}
+    explicit PickMoveTask(int depth, std::shared_ptr<Task> parent, int slot, std::shared_ptr<SearchContext> ctx, State s,
+                          const Board::ForcedMove& threat, const ChanceExpansion::Shared& shared) :
+        Task(std::move(ctx)), depth_(depth), s_(s), parent_task_(std::move(parent)), slot_(slot),
+        is_prepared_(true), threat_(threat), shared_(shared) {}
 
-private:
-    void do_got_one_subresult() override {
-        if (fetch_and_decrement_if_positive(waiting_for_subresults_) == 1) {
-            combine_subresults();
-        }
-    }
+    explicit PickMoveTask(std::promise<Result> parent, std::shared_ptr<SearchContext> ctx, State s) :
+        Task(std::move(ctx)), depth_(0), s_(s), parent_task_(std::move(parent)) {}
 
-    void do_got_awesome_subresult() override {
-        if (waiting_for_subresults_.exchange(0) > 0) {
+private:
+    void do_got_one_subresult(int slot, double v) override {
+        values_[slot].store(v, std::memory_order_relaxed);
+        if (v >= double(INT_MAX) && !ctx_->deterministic_) {
+            // A win; don't wait for the rest. (The deterministic search
+            // does, since combining early would depend on which siblings
+            // had finished.)
+            if (waiting_for_subresults_.exchange(0) > 0) {
+                combine_subresults();
+            }
+        } else if (fetch_and_decrement_if_positive(waiting_for_subresults_) == 1) {
             combine_subresults();
         }
     }
 
-    void set_and_notify_impl(std::weak_ptr<Task>& parent, double v, int m) {
-        if (auto p = parent.lock()) {
-            this->result_ = {v, m};
-            p->got_one_subresult();
-        }
+    void set_and_notify_impl(std::shared_ptr<Task>& parent, double v, int m) {
+        parent->got_one_subresult(slot_, v);
+        parent = nullptr;
     }
 
     void set_and_notify_impl(std::promise<Result>& parent, double v, int m) {
@@ -220,102 +367,215 @@ private:
     }
 
     void set_and_notify(double v, int m) {
+        TRACE_INSTANT("notify");
         parent_task_.visit([&](auto& x) { set_and_notify_impl(x, v, m); });
     }
 
     void do_evaluate_and_notify() override {
         if (s_.is_tie_game()) {
-            return set_and_notify(eval_(s_), 0);
+            return set_and_notify(ctx_->eval_(s_), 0);
         }
-        if (std::chrono::steady_clock::now() >= deadline_) {
-            return set_and_notify(eval_(s_), 0);
+        // The root's moves are always looked at, even with no time left, so
+        // that it blocks a threat or takes a win instead of playing column 0.
+        if (depth_ >= ctx_->max_depth_ || (depth_ > 0 && ctx_->is_out_of_time())) {
+            return set_and_notify(ctx_->eval_(s_), 0);
         }
-
-#if LOOK_FOR_CHECKS
-        auto forced_move = s_.must_respond_to_threat();
-        if (forced_move.is_forced) {
-            if (forced_move.is_double_threat) {
-                // We are threatened two ways; we lose.
-                // Still, block one of the threats, in case our opponent is stupid.
-                return set_and_notify(INT_MIN, forced_move.move);
-            }
+        if (depth_ > 0 && !ctx_->deterministic_ && ctx_->is_over_live_cap()) {
+            return set_and_notify(ctx_->eval_(s_), 0);
         }
-#endif
-
-        int columns = s_.count_columns();
 
-        if (columns == 0) {
-            // First move of the game; don't waste time exploring it.
-            return set_and_notify(0, 0);
-        } else if (columns == 1) {
-            // Second move of the game; I conjecture that leaving the baseline open-ended is always a mistake.
-            return set_and_notify(1, 1);
+        MoveExpansion node(s_, depth_, is_prepared_ ? &threat_ : nullptr, is_prepared_ ? &shared_ : nullptr);
+        Result r;
+        if (node.is_settled(&r)) {
+            return set_and_notify(r.first, r.second);
         }
-
-        for (int m = -1; m <= columns; ++m) {
-            State next = s_;
-            if (next.apply_in_place_without_drawing(m)) {
-                return set_and_notify(INT_MAX, m);
-            }
-#if LOOK_FOR_CHECKS
-            if (forced_move.is_forced && m != forced_move.move) {
-                continue;
-            }
-#endif
-            subtasks_.push_back(std::make_shared<ExpectCardTask>(depth_+1, shared_from_this(), eval_, next, m, deadline_));
+        double priors[MoveOrdering::max_moves];
+        if (g_move_priors && depth_ / 2 < g_move_prior_plies && g_move_priors(s_, priors)) {
+            // Stable, so the history heuristic still breaks ties.
+            std::stable_sort(node.moves(), node.moves() + node.count(), [&](int a, int b) { return priors[a+1] > priors[b+1]; });
         }
-        waiting_for_subresults_ = subtasks_.size();
-        for (auto&& t : subtasks_) {
-            spawn_thread([t] { t->evaluate_and_notify(); });
+        auto is_wanted = [&](int m) {
+            return depth_ != 0 || ctx_->root_moves_.empty() ||
+                   std::find(ctx_->root_moves_.begin(), ctx_->root_moves_.end(), m) != ctx_->root_moves_.end();
+        };
+        std::vector<std::shared_ptr<Task>> children;
+        auto add_child = [&](int m, const State& next) {
+            values_[n_children_].store(INT_MIN, std::memory_order_relaxed);
+            moves_[n_children_] = m;
+            children.push_back(std::make_shared<ExpectCardTask>(depth_+1, shared_from_this(), n_children_, ctx_, next));
+            n_children_ += 1;
+        };
+        if (node.expand(is_wanted, add_child, &r)) {
+            return set_and_notify(r.first, r.second);
+        }
+        if (children.empty()) {
+            // Only in a root-split search, when none of this share's moves
+            // block the threat: they all lose.
+            assert(depth_ == 0 && !ctx_->root_moves_.empty());
+            return set_and_notify(INT_MIN, ctx_->root_moves_.front());
+        }
+        waiting_for_subresults_ = children.size();
+        for (auto&& t : children) {
+            dispatch(std::move(t));
         }
     }
 
     void combine_subresults() {
+        TRACE_SCOPE("combine");
         fetch_and_max(max_search_depth, depth_);
+        fetch_and_max(ctx_->depth_reached_, depth_);
         assert(waiting_for_subresults_ <= 0);
-        Result r = { INT_MIN, 0 };
-        for (auto&& sub : subtasks_) {
-            r = std::max(r, sub->result_);
-        }
+        Result r = MoveExpansion::combine(s_, depth_, n_children_, [&](int i) {
+            return Result{ values_[i].load(std::memory_order_relaxed), moves_[i] };
+        });
         return set_and_notify(r.first, r.second);
     }
 };
 
 void ExpectCardTask::do_evaluate_and_notify()
 {
-    if (std::chrono::steady_clock::now() >= deadline_) {
-        return set_and_notify(eval_(s_));
-    }
-    Color who = s_.active_player();
-    State next = s_;
-    for (int v = 1; v <= 7; ++v) {
-        int weight = s_.count_unseen_cards(who, v);
-        assert(0 <= weight && weight <= 2);
-        if (weight != 0) {
-            next.draw_this_card(who, v);
-            subtasks_.push_back(std::make_shared<PickMoveTask>(depth_+1, shared_from_this(), eval_, next, deadline_));
-            weights_.push_back(weight);
-        }
+    // And so are the draws after them, which completes the first ply.
+    if (depth_ > 1 && ctx_->is_out_of_time()) {
+        return set_and_notify(ctx_->eval_(s_));
     }
-    waiting_for_subresults_ = subtasks_.size();
-    for (auto&& t : subtasks_) {
-        spawn_thread([t] { t->evaluate_and_notify(); });
+    node_ = std::make_unique<ChanceExpansion>(s_);
+    // Each child is the mover's PickMoveTask; only those that have to be
+    // searched are created, and the rest are counted as nodes here.
+    const bool is_leaf = s_.is_tie_game() || depth_+1 >= ctx_->max_depth_ ||
+                         (!ctx_->deterministic_ && ctx_->is_over_live_cap());
+    std::vector<std::shared_ptr<Task>> children;
+    int settled = node_->expand_children(depth_+1, is_leaf, ctx_->eval_, values_, [&](int i, const ChanceExpansion::Draw& d) {
+        children.push_back(std::make_shared<PickMoveTask>(depth_+1, shared_from_this(), i, ctx_, node_->after(d),
+                                                          d.threat, node_->shared()));
+    });
+    ctx_->nodes_.fetch_add(settled, std::memory_order_relaxed);
+    if (children.empty()) {
+        return combine_subresults();
     }
-    if (subtasks_.size() == 0) {
-        // This is a tie game, because no cards are left!
-        return set_and_notify(0);
+    waiting_for_subresults_ = children.size();
+    for (auto&& t : children) {
+        dispatch(std::move(t));
     }
 }
 
-Result recursively_evaluate(LeafEvaluationFunction eval, const State& s, std::chrono::milliseconds timeout)
+static Result run_search(std::shared_ptr<SearchContext> ctx, const State& s, SearchStats *stats)
 {
     recursively_scheduled_tasks = 0;
     recursively_evaluated_tasks = 0;
     max_search_depth = 0;
-    auto deadline = std::chrono::steady_clock::now() + timeout;
     std::promise<Result> root;
     std::future<Result> result = root.get_future();
-    auto head = std::make_shared<PickMoveTask>(std::move(root), eval, s, deadline);
+    auto head = std::make_shared<PickMoveTask>(std::move(root), ctx, s);
     head->evaluate_and_notify();
-    return result.get();
+    Result r = result.get();
+    if (stats != nullptr) {
+        stats->nodes += ctx->nodes_;
+        stats->depth = std::max(stats->depth, (ctx->depth_reached_ + 1) / 2);
+        stats->peak_live_nodes = std::max(stats->peak_live_nodes, long(ctx->peak_live_nodes_));
+    }
+    return r;
+}
+
+Result recursively_evaluate(LeafEvaluationFunction eval, const State& s, std::chrono::milliseconds timeout)
+{
+    return recursively_evaluate(eval, s, timeout, nullptr);
+}
+
+Result recursively_evaluate(LeafEvaluationFunction eval, const State& s, std::chrono::milliseconds timeout, SearchStats *stats)
+{
+    Result book;
+    if (find_book_move(s, &book)) {
+        return book;
+    }
+    // A forced win through a chain of threats is usually too deep for the
+    // full-width search, but cheap for the threat-space search to prove.
+    ProvenWin win = prove_forced_win(s);
+    if (win.is_proven) {
+        return { INT_MAX, win.move };
+    }
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    return run_search(std::make_shared<SearchContext>(eval, deadline), s, stats);
+}
+
+Result evaluate_to_depth(LeafEvaluationFunction eval, const State& s, int plies, Deadline deadline, bool *finished, SearchStats *stats)
+{
+    auto ctx = std::make_shared<SearchContext>(eval, deadline);
+    ctx->max_depth_ = (plies == 0) ? INT_MAX : 2 * plies;
+    Result r = run_search(ctx, s, stats);
+    *finished = !ctx->cut_short_;
+    return r;
+}
+
+Result evaluate_root_moves(LeafEvaluationFunction eval, const State& s, const std::vector<int>& moves, int plies, Deadline deadline, SearchStats *stats, const std::atomic<bool> *cancel)
+{
+    assert(!moves.empty());
+    auto ctx = std::make_shared<SearchContext>(eval, deadline);
+    ctx->root_moves_ = moves;
+    ctx->cancel_ = cancel;
+    if (plies > 0) {
+        ctx->max_depth_ = 2 * plies;
+        ctx->deterministic_ = true;
+    }
+    return run_search(ctx, s, stats);
+}
+
+Result deterministically_evaluate(LeafEvaluationFunction eval, const State& s, int max_plies, long max_nodes, SearchStats *stats, bool *finished)
+{
+    assert(max_plies > 0 || max_nodes > 0);
+    bool unused_finished;
+    if (finished == nullptr) {
+        finished = &unused_finished;
+    }
+    *finished = true;
+    ProvenWin win = prove_forced_win(s);
+    if (win.is_proven) {
+        return { INT_MAX, win.move };
+    }
+    SearchStats unused;
+    if (stats == nullptr) {
+        stats = &unused;
+    }
+    bool cut_short = false;
+    auto search_to_depth = [&](int plies, long budget, SearchStats *iteration) {
+        auto ctx = std::make_shared<SearchContext>(eval, Deadline::max());
+        ctx->max_depth_ = 2 * plies;
+        ctx->deterministic_ = true;
+        ctx->max_nodes_ = budget;
+        Result r = run_search(ctx, s, iteration);
+        cut_short = ctx->cut_short_;
+        return r;
+    };
+
+    if (max_nodes == 0) {
+        Result r = search_to_depth(max_plies, 0, stats);
+        *finished = !cut_short;
+        return r;
+    }
+    // Deepen one ply at a time, each iteration on what's left of the budget,
+    // and keep the deepest iteration that completed; cutting one short would
+    // make the result depend on scheduling.
+    Result r;
+    long prev_nodes = 0;
+    for (int plies = 1; max_plies == 0 || plies <= max_plies; ++plies) {
+        SearchStats iteration;
+        Result deeper = search_to_depth(plies, (plies == 1) ? 0 : max_nodes - stats->nodes, &iteration);
+        stats->peak_live_nodes = std::max(stats->peak_live_nodes, iteration.peak_live_nodes);
+        if (cut_short && plies > 1) {
+            *finished = false;
+            break;  // keep the last iteration that completed
+        }
+        r = deeper;
+        stats->nodes += iteration.nodes;
+        stats->depth = std::max(stats->depth, iteration.depth);
+        bool is_proven = (r.first >= double(INT_MAX) || r.first <= double(INT_MIN));
+        if (is_proven || iteration.nodes == prev_nodes) {
+            break;  // deeper searches can't change anything
+        }
+        if (cut_short || stats->nodes >= max_nodes) {
+            *finished = (plies == max_plies);
+            break;  // deeper searches can't fit
+        }
+        prev_nodes = iteration.nodes;
+    }
+    return r;
 }
@@ -2,15 +2,99 @@
 
 #include "state.h"
 #include <atomic>
+#include <climits>
 #include <chrono>
+#include <functional>
 #include <utility>
+#include <vector>
 
 using LeafEvaluationFunction = double(*)(const State&);
 
 double simplest_eval(const State& s);
 
+// Like simplest_eval, but the coin flip is seeded by the position itself,
+// so the same position (or its mirror image) always gets the same value.
+double hashed_eval(const State& s);
+
 extern int recursively_scheduled_tasks;
 extern int recursively_evaluated_tasks;
 extern std::atomic<int> max_search_depth;
 
+// Searches run on a shared pool of NUM_THREADS workers, unless told otherwise.
+// Don't call this while a search is in progress.
+void set_search_threads(int n);
+int count_search_threads();
+
+// The search plays the first two moves of the game without searching them
+// (the first anywhere, the second to the right of it), unless told not to,
+// as when building the opening book. Don't call this during a search either.
+void set_assume_opening_moves(bool assume);
+bool assumes_opening_moves();
+
+// The timed search frees each subtree once its value is known, so what it
+// holds at once is mostly the frontier still queued. This caps those live
+// tasks (about 1M by default, or 0 for no cap): past it, a timed search
+// stops expanding, and evaluates what it would have expanded, and a
+// deterministic one goes depth first, with the same results. Don't call
+// this during a search.
+void set_max_live_nodes(long n);
+
+// Once *stop is true, the searches here give up as if their time had run
+// out, even the deterministic ones, for a driver that's told to stop; the
+// caller resets it for the next search. nullptr (the default) for none.
+// Either way, a search always finishes its first ply.
+// Don't call this during a search.
+void set_stop_flag(const std::atomic<bool> *stop);
+bool is_stop_requested();
+
+// Runs f on the search's thread pool, for other searches that share it;
+// or several, in order, taking the queue's lock once for them all.
+void schedule_search_task(std::function<void()> f);
+void schedule_search_tasks(std::vector<std::function<void()>> fs);
+
+// What's known about a position's moves before searching it, e.g. what a
+// MatchboxPlayer has learned: fills priors[m+1] for each move m from -1 to
+// count_columns(), or returns false if it knows nothing about s. The timed
+// search orders its moves by their priors, in the first `max_plies` plies,
+// so that the likely ones are expanded first and get deeper before time
+// runs out. It's called from every search thread at once. Pass nullptr to
+// go back to the history heuristic alone. Don't call this during a search.
+using MovePriorFunction = std::function<bool(const State& s, double *priors)>;
+void set_move_priors(MovePriorFunction f, int max_plies = 4);
+
+struct SearchStats {
+    long nodes = 0;
+    int depth = 0;  // in plies
+    long peak_live_nodes = 0;  // the most search tasks held at once, for the timed search
+};
+
+// Plays the opening book's move, if there is one (see opening_book.h).
 std::pair<double, int> recursively_evaluate(LeafEvaluationFunction eval, const State& s, std::chrono::milliseconds timeout);
+std::pair<double, int> recursively_evaluate(LeafEvaluationFunction eval, const State& s, std::chrono::milliseconds timeout, SearchStats *stats);
+
+// A search to a fixed depth (in plies) that gives up at the deadline, as one
+// iteration of iterative deepening, but for the first ply, which it always
+// finishes. Sets *finished unless it was cut short.
+// With plies == 0, it's the same search as recursively_evaluate.
+std::pair<double, int> evaluate_to_depth(LeafEvaluationFunction eval, const State& s, int plies, std::chrono::steady_clock::time_point deadline, bool *finished, SearchStats *stats = nullptr);
+
+// Searches only the given root moves, as one share of a root-split search
+// (see distributed.h): to a fixed depth, deterministically, if plies > 0,
+// or else until the deadline. The moves should include at most one of each
+// mirror-image pair on a symmetric board, as the full search would.
+// Once *cancel is true, it gives up as if its time had run out, like the
+// stop flag, but for this search alone.
+std::pair<double, int> evaluate_root_moves(LeafEvaluationFunction eval, const State& s, const std::vector<int>& moves, int plies, std::chrono::steady_clock::time_point deadline, SearchStats *stats = nullptr, const std::atomic<bool> *cancel = nullptr);
+
+// Searches to a fixed depth (in plies) or within a node budget, ignoring the
+// clock, and waits for every subtask. Given a deterministic eval such as
+// hashed_eval, the value, move and node count depend only on the position
+// and the limits, not on the number of threads or the scheduling order.
+// Pass max_plies == 0 for no depth limit, or max_nodes == 0 for no node budget.
+// Within a budget, it deepens a ply at a time, and returns the deepest
+// iteration that completed before the budget ran out; the nodes it counts
+// are theirs, at most max_nodes, unless the first ply alone is more (it's
+// always searched). Sets *finished unless the stop flag or the budget cut
+// the search short of max_plies (or, with no depth limit, of a proof or
+// a search that deepening can't change).
+std::pair<double, int> deterministically_evaluate(LeafEvaluationFunction eval, const State& s, int max_plies, long max_nodes, SearchStats *stats = nullptr, bool *finished = nullptr);
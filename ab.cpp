@@ -1,73 +1,318 @@
-
 #include "ab.h"
+#include "engine.h"
+#include "move_ordering.h"
+#include "packed_state.h"
 #include "state.h"
+#include "transposition_table.h"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <stdlib.h>
+#include <thread>
 #include <utility>
+#include <vector>
 
-double simplest_eval(const State& s)
-{
-    return (rand() % 2) ? 1 : -1;
-}
+using Deadline = std::chrono::steady_clock::time_point;
+using Result = std::pair<double, int>;
 
-std::pair<double, int> recursively_evaluate(LeafEvaluationFunction eval, const State& s, int depth)
-{
-    auto expectation_for_this_move = [&eval, &s, &depth](int move) -> double {
-        State next = s;
-        if (next.apply_in_place_without_drawing(move)) {
-            return INT_MAX;  // this move is winning!
+// What the threads of a Lazy SMP search share, besides the table.
+struct SharedSearch {
+    TranspositionTable *tt_;
+    std::atomic<bool> stop_ {false};
+    std::atomic<long> nodes_ {0};
+
+    explicit SharedSearch(TranspositionTable *tt) : tt_(tt) {}
+};
+
+struct SequentialSearch {
+    LeafEvaluationFunction eval_;
+    Deadline deadline_;
+    long max_nodes_;
+    long nodes_ = 0;
+    bool can_abort_ = false;  // not during the main thread's first iteration
+    bool aborted_ = false;
+
+    // Only in a Lazy SMP search: thread 0 is the main thread.
+    SharedSearch *shared_ = nullptr;
+    int id_ = 0;
+    long unshared_nodes_ = 0;
+
+    explicit SequentialSearch(LeafEvaluationFunction eval, Deadline deadline, long max_nodes) :
+        eval_(eval), deadline_(deadline), max_nodes_(max_nodes) {}
+
+    bool should_abort() {
+        if (aborted_) {
+            return true;
+        }
+        nodes_ += 1;
+        long total_nodes = nodes_;
+        if (shared_ != nullptr) {
+            if (++unshared_nodes_ == 256) {
+                shared_->nodes_.fetch_add(unshared_nodes_, std::memory_order_relaxed);
+                unshared_nodes_ = 0;
+            }
+            if (id_ != 0 && shared_->stop_.load(std::memory_order_relaxed)) {
+                aborted_ = true;
+                return true;
+            }
+            total_nodes = shared_->nodes_.load(std::memory_order_relaxed) + unshared_nodes_;
+        }
+        if (can_abort_) {
+            aborted_ = (max_nodes_ != 0 && total_nodes > max_nodes_) ||
+                       (deadline_ != Deadline::max() && nodes_ % 1024 == 0 && std::chrono::steady_clock::now() >= deadline_);
+        }
+        return aborted_;
+    }
+
+    // `next` is s after a move that didn't win, before its mover draws.
+    double expectation_for_this_move(const State& s, const State& next, int depth) {
+        if (should_abort()) {
+            return 0;
         }
 
+        // The player who just moved draws their next card.
         Color who = s.active_player();
         double sum = 0.0;
         int count = 0;
-        for (int v = 1; v <= 7; ++v) {
+        for (int v = 1; v <= GameRules::max_value; ++v) {
             int weight = s.count_unseen_cards(who, v);
-            assert(0 <= weight && weight <= 2);
+            assert(0 <= weight && weight <= GameRules::copies);
             if (weight != 0) {
-                next.draw_this_card(who, v);
-                auto vm = recursively_evaluate(eval, next, depth - 1);
+                State drawn = next;
+                drawn.draw_this_card(who, v);
+                auto vm = search(drawn, depth - 1);
                 sum += weight * vm.first;
                 count += weight;
             }
         }
         return -sum / count;
-    };
-
-#if 0
-    auto fm = s.must_respond_to_threat();
-    if (fm.is_forced) {
-        if (fm.is_double_threat) {
-            return { INT_MIN, fm.move };
-        } else {
-            // This move is forced.
-            double expectation = expectation_for_this_move(fm.move);
-            return  { expectation, fm.move };
-        }
     }
-#endif
 
-    if ((depth == 0) || s.is_tie_game()) {
-        return { eval(s), 0 };
-    }
+    Result search(const State& s, int depth) {
+        if (should_abort()) {
+            return { 0, 0 };
+        }
+        if ((depth == 0) || s.is_tie_game()) {
+            return { eval_(s), 0 };
+        }
+
+        TranspositionTable *tt = (shared_ != nullptr) ? shared_->tt_ : nullptr;
+        std::pair<PackedState, bool> key_flipHorizontal;
+        uint64_t key = 0;
+        int tt_move = -2;
+        if (tt != nullptr) {
+            key_flipHorizontal = s.toPackedCanonical();
+            key = std::hash<PackedState>()(key_flipHorizontal.first);
+            TranspositionTable::Entry e;
+            if (tt->probe(key, &e)) {
+                tt_move = key_flipHorizontal.second ? s.mirror_move(e.move) : e.move;
+                if (e.depth >= depth) {
+                    return { e.value, tt_move };
+                }
+            }
+        }
+        auto store = [&](Result r) {
+            if (tt != nullptr) {
+                int m = key_flipHorizontal.second ? s.mirror_move(r.second) : r.second;
+                tt->store(key, TranspositionTable::Entry{ r.first, m, depth });
+            }
+            return r;
+        };
 
-    int columns = s.count_columns();
+        int columns = s.count_columns();
 
-    std::pair<double, int> best = { INT_MIN, 0 };
+        Result best = { INT_MIN, 0 };
 
-    if (columns == 0) {
-        columns = -1;  // there's only one legal move
-    } else if (columns == 1) {
-        columns = 0;  // the two sides are symmetric
+        if (columns == 0) {
+            columns = -1;  // there's only one legal move
+        }
+        const bool is_symmetric = s.is_mirror_symmetric();
+
+        // Try the moves that were good elsewhere first: a winning move
+        // ends the loop early, and saves searching everything after it.
+        MoveOrdering& ordering = thread_move_ordering();
+        int moves[MoveOrdering::max_moves];
+        int n = ordering.ordered_moves(s, depth, moves);
+        int *tt_first = std::find(moves, moves + n, tt_move);
+        if (tt_first != moves + n) {
+            std::rotate(moves, tt_first, tt_first + 1);
+        } else if (id_ != 0 && n > 2) {
+            // Each helper thread tries a different second move first,
+            // so that the threads don't all search the same subtrees.
+            std::swap(moves[0], moves[1 + id_ % (n - 1)]);
+        }
+        auto is_searched = [&](int move) {
+            // A mirror image has the same value as its twin, which is searched.
+            return move <= columns && !(is_symmetric && s.mirror_move(move) < move);
+        };
+        bool any = false;
+        for (int i=0; i < n; ++i) {
+            int move = moves[i];
+            if (!is_searched(move)) {
+                continue;
+            }
+            State next = s;
+            if (next.apply_in_place_without_drawing(move)) {
+                // Of several wins, play the leftmost, not whichever this
+                // thread's move ordering happened to try first.
+                for (int j=0; j < n; ++j) {
+                    State other = s;
+                    if (moves[j] < move && is_searched(moves[j]) && other.apply_in_place_without_drawing(moves[j])) {
+                        move = moves[j];
+                    }
+                }
+                ordering.record_good_move(s, depth, move, depth * depth);
+                return store({ INT_MAX, move });  // the best possible outcome
+            }
+            double expectation = expectation_for_this_move(s, next, depth);
+            if (aborted_) {
+                return best;
+            }
+            // Equal values go to the leftmost move, whatever the order.
+            if (!any || expectation > best.first || (expectation == best.first && move < best.second)) {
+                best = { expectation, move };
+                any = true;
+            }
+        }
+        if (best.first > double(INT_MIN)) {
+            ordering.record_good_move(s, depth, best.second, depth * depth);
+        }
+        return store(best);
     }
 
-    for (int move = -1; move <= columns; ++move) {
-        double expectation = expectation_for_this_move(move);
-        if (expectation == double(INT_MAX)) {
-            return { INT_MAX, move };  // the best possible outcome
+    // Deepens one ply at a time, from `first_plies`, until it's out of
+    // budget, or the value is proven, or the tree is exhausted; returns
+    // the deepest iteration that finished, and its depth in *depth.
+    Result deepen(const State& s, int first_plies, int max_plies, int *depth) {
+        Result r = { 0, 0 };
+        long prev_nodes = -1;
+        if (max_plies == 0) {
+            max_plies = GameRules::max_cards + 1;  // there are only so many cards to play
         }
-        if (expectation > best.first) {
-            best = { expectation, move };
+        for (int plies = first_plies; plies <= max_plies; ++plies) {
+            long before = nodes_;
+            Result iteration = search(s, plies);
+            if (aborted_) {
+                break;
+            }
+            r = iteration;
+            *depth = plies;
+            can_abort_ = true;
+            // Stop once the value is proven, or the tree is exhausted. (With
+            // a table, an iteration can cost the same as the last by hitting
+            // the table at once; that proves nothing.)
+            bool is_proven = (r.first >= double(INT_MAX) || r.first <= double(INT_MIN));
+            bool is_exhausted = (shared_ == nullptr && nodes_ - before == prev_nodes);
+            if (is_proven || is_exhausted) {
+                break;
+            }
+            prev_nodes = nodes_ - before;
         }
+        return r;
+    }
+};
+
+Result sequentially_evaluate(LeafEvaluationFunction eval, const State& s, int max_plies, long max_nodes, Deadline deadline, SearchStats *stats)
+{
+    SequentialSearch search(eval, deadline, max_nodes);
+    Result r;
+    int depth = 0;
+    if (max_nodes == 0 && deadline == Deadline::max()) {
+        assert(max_plies > 0);
+        r = search.search(s, max_plies);
+        depth = max_plies;
+    } else {
+        r = search.deepen(s, 1, max_plies, &depth);
+    }
+    if (stats != nullptr) {
+        stats->nodes += search.nodes_;
+        stats->depth = std::max(stats->depth, depth);
+    }
+    return r;
+}
+
+Result lazy_smp_evaluate(LeafEvaluationFunction eval, const State& s, int threads, TranspositionTable *tt,
+                         int max_plies, long max_nodes, Deadline deadline, SearchStats *stats)
+{
+    assert(threads >= 1);
+    SharedSearch shared(tt);
+    Result r;
+    int depth = 0;
+    std::vector<std::thread> helpers;
+    for (int id = 1; id < threads; ++id) {
+        helpers.emplace_back([&, id]() {
+            SequentialSearch search(eval, deadline, max_nodes);
+            search.shared_ = &shared;
+            search.id_ = id;
+            search.can_abort_ = true;
+            // Half the helpers search a ply ahead of the main thread, and
+            // so fill in the table for its next iteration.
+            int unused;
+            search.deepen(s, 1 + (id % 2), (max_plies == 0) ? 0 : max_plies + 1, &unused);
+            shared.nodes_ += search.unshared_nodes_;
+        });
+    }
+    {
+        SequentialSearch search(eval, deadline, max_nodes);
+        search.shared_ = &shared;
+        r = search.deepen(s, 1, max_plies, &depth);
+        shared.nodes_ += search.unshared_nodes_;
+        shared.stop_ = true;
+    }
+    for (auto& t : helpers) {
+        t.join();
+    }
+    if (stats != nullptr) {
+        stats->nodes += shared.nodes_;
+        stats->depth = std::max(stats->depth, depth);
     }
-    return best;
+    return r;
 }
+
+class SequentialEngine : public Engine {
+public:
+    explicit SequentialEngine(LeafEvaluationFunction eval) : eval_(eval) {}
+
+    SearchResult search(const State& s, const SearchLimits& limits) const override {
+        SearchResult result;
+        Deadline deadline = (limits.time.count() > 0) ? std::chrono::steady_clock::now() + limits.time : Deadline::max();
+        auto vm = sequentially_evaluate(eval_, s, limits.plies, limits.nodes, deadline, &result.stats);
+        result.value = vm.first;
+        result.move = vm.second;
+        return result;
+    }
+
+private:
+    LeafEvaluationFunction eval_;
+};
+
+static EngineRegistration sequential_registration(
+    "sequential", "single-threaded depth-first expectimax; iterative deepening given nodes or time",
+    [](LeafEvaluationFunction eval) -> std::unique_ptr<Engine> { return std::make_unique<SequentialEngine>(eval); });
+
+// The table lives as long as the engine, so it carries over from one
+// search to the next, as in a game. Concurrent searches share it too.
+class LazySmpEngine : public Engine {
+public:
+    explicit LazySmpEngine(LeafEvaluationFunction eval) : eval_(eval), tt_(std::make_unique<TranspositionTable>(20)) {}
+
+    SearchResult search(const State& s, const SearchLimits& limits) const override {
+        SearchResult result;
+        Deadline deadline = (limits.time.count() > 0) ? std::chrono::steady_clock::now() + limits.time : Deadline::max();
+        assert(limits.plies > 0 || limits.nodes > 0 || deadline != Deadline::max());
+        auto vm = lazy_smp_evaluate(eval_, s, count_search_threads(), tt_.get(),
+                                    limits.plies, limits.nodes, deadline, &result.stats);
+        result.value = vm.first;
+        result.move = vm.second;
+        return result;
+    }
+
+private:
+    LeafEvaluationFunction eval_;
+    std::unique_ptr<TranspositionTable> tt_;
+};
+
+static EngineRegistration lazy_smp_registration(
+    "lazysmp", "Lazy SMP: the sequential search on every thread, sharing a position cache",
+    [](LeafEvaluationFunction eval) -> std::unique_ptr<Engine> { return std::make_unique<LazySmpEngine>(eval); });
@@ -1,10 +1,29 @@
 #pragma once
 
+#include "ab-timed.h"
 #include "state.h"
+#include <chrono>
+#include <climits>
 #include <utility>
 
-using LeafEvaluationFunction = double(*)(const State&);
+// The original search: single-threaded, depth-first expectimax, with no
+// pruning but a winning move. It's the "sequential" engine (see engine.h).
+//
+// With only max_plies, it searches to exactly that depth. With a node
+// budget or a deadline, it deepens one ply at a time (up to max_plies, if
+// that's positive) and returns the deepest iteration that finished; the
+// first iteration always finishes.
+std::pair<double, int> sequentially_evaluate(LeafEvaluationFunction eval, const State& s, int max_plies, long max_nodes,
+                                             std::chrono::steady_clock::time_point deadline, SearchStats *stats = nullptr);
 
-double simplest_eval(const State& s);
+class TranspositionTable;
 
-std::pair<double, int> recursively_evaluate(LeafEvaluationFunction eval, const State& s, int depth);
+// Lazy SMP: the same search on `threads` threads at once, which share
+// nothing but the table. The main thread deepens as above; the helpers
+// search the same root, half of them a ply deeper, each trying the moves
+// in a slightly different order, and they stop when the main thread is
+// done. What one thread finds, the others find in the table. It's never
+// deterministic; the table may be reused, or even shared, across searches.
+std::pair<double, int> lazy_smp_evaluate(LeafEvaluationFunction eval, const State& s, int threads, TranspositionTable *tt,
+                                         int max_plies, long max_nodes, std::chrono::steady_clock::time_point deadline,
+                                         SearchStats *stats = nullptr);
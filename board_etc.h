@@ -8,6 +8,7 @@
 
 #include "nibble_writer.h"
 #include "packed_state.h"
+#include "rules.h"
 
 enum Color {
     Red = 0,
@@ -15,124 +16,164 @@ enum Color {
     Nobody = 2,
 };
 
+// One byte: the value plus 8 for Black, or 16 for no card. So the color
+// is the high bits, and the low nibble is the card's packed form.
 struct Card {
-    explicit Card() : who_(Nobody), value_(0) {}
-    explicit Card(Color who, int value) : who_(who), value_(value) {}
+    explicit Card() : code_(8 * Nobody) {}
+    explicit Card(Color who, int value) : code_(who == Nobody ? 8 * Nobody : value + 8 * who) {}
     explicit Card(const char *s) {
         assert('1' <= s[0] && s[0] <= '7');
         assert(s[1] == 'r' || s[1] == 'b');
         assert(s[2] == '\0');
-        who_ = (s[1] == 'r') ? Red : Black;
-        value_ = (s[0] - '0');
+        code_ = (s[0] - '0') + ((s[1] == 'r') ? 0 : 8);
     }
-    Color color() const { return who_; }
-    int value() const { return value_; }
+    Color color() const { return Color(code_ >> 3); }
+    int value() const { return code_ & 7; }
 
     std::string toString() const {
         std::string result = "..";
-        if (who_ != Nobody) {
-            result[0] = ('0' + value_);
-            result[1] = (who_ == Red) ? 'r' : 'b';
+        if (color() != Nobody) {
+            result[0] = ('0' + value());
+            result[1] = (color() == Red) ? 'r' : 'b';
         }
         return result;
     }
 
     nibble_writer toPacked(nibble_writer it) const {
-        if (who_ == Nobody) {
-            it.write(0);
-        } else {
-            it.write(value_ + 8 * who_);
-        }
+        it.write(code_ & 15);
         return it;
     }
 
     friend bool operator==(Card a, Card b) noexcept {
-        return a.who_ == b.who_ && a.value_ == b.value_;
+        return a.code_ == b.code_;
     }
     friend bool operator!=(Card a, Card b) noexcept {
         return !(a == b);
     }
 private:
-    Color who_ : 3;
-    int8_t value_ : 5;
+    uint8_t code_;
 };
+static_assert(sizeof(Card) == 1, "Card should be one byte");
 
+// A read-only view of one column of a Board, from the bottom up.
 struct Column {
-    explicit Column() = default;
+    explicit Column(const Card *cards, int size) : cards_(cards), size_(size) {}
     bool empty() const { return size_ == 0; }
     int size() const { return size_; }
-    void emplace_back(Card card) { assert(size_ < 28); cards_[size_++] = card; }
     const Card& topmost() const { assert(1 <= size_); return cards_[size_-1]; }
     Card operator[](int i) const { assert(0 <= i && i < size_); return cards_[i]; }
+
+    friend bool operator==(const Column& a, const Column& b) noexcept {
+        return a.size_ == b.size_ && std::equal(a.cards_, a.cards_ + a.size_, b.cards_);
+    }
 private:
-    signed char size_ = 0;
-    Card cards_[28];
+    const Card *cards_;
+    int size_;
 };
+static_assert(sizeof(Column) <= 16, "Column should be a pointer and a size");
 
-struct Board {
-    std::vector<Column> columns_;
+struct ForcedMove {
+    bool is_forced;
+    bool is_double_threat;
+    int move;
+};
 
-public:
-    explicit Board() = default;
-    explicit Board(std::vector<std::vector<Card>> cols) {
-        columns_.resize(cols.size());
+// All the cards on the board, column after column, with no heap storage,
+// so that copying a Board (which the search does for every move) is a
+// plain copy of a few dozen bytes. It's sized, and it checks for wins,
+// by the Rules R (see rules.h); everything else uses Board, for GameRules.
+template<class R>
+struct BasicBoard {
+    static constexpr int max_cards = R::max_cards;
+
+    explicit BasicBoard() = default;
+    explicit BasicBoard(std::vector<std::vector<Card>> cols) {
         for (int i=0; i < int(cols.size()); ++i) {
-            for (const Card& card : cols[i]) {
-                columns_[i].emplace_back(card);
+            assert(!cols[i].empty());
+            for (int j=0; j < int(cols[i].size()); ++j) {
+                apply_in_place(i, cols[i][j]);
             }
         }
     }
 
-    void populate_unseen_cards(int8_t (&unseen_cards)[2][8]) {
+    void populate_unseen_cards(int8_t (&unseen_cards)[2][R::max_value + 1]) {
         for (int w=0; w < 2; ++w) {
             unseen_cards[w][0] = 0;
-            for (int v=1; v <= 7; ++v) {
-                unseen_cards[w][v] = 2;
+            for (int v=1; v <= R::max_value; ++v) {
+                unseen_cards[w][v] = R::copies;
             }
         }
-        for (const Column& col : columns_) {
-            for (int i=0; i < col.size(); ++i) {
-                const Card& card = col[i];
-                assert(card.color() != Nobody);
-                int8_t& cell = unseen_cards[card.color()][card.value()];
-                cell -= 1;
-                assert(cell >= 0);
-            }
+        for (int i=0; i < count_cards(); ++i) {
+            const Card& card = cards_[i];
+            assert(card.color() != Nobody);
+            int8_t& cell = unseen_cards[card.color()][card.value()];
+            cell -= 1;
+            assert(cell >= 0);
         }
     }
 
-    int count_columns() const { return columns_.size(); }
+    Column column(int x) const {
+        assert(0 <= x && x < columns_);
+        return Column(cards_ + start_[x], height(x));
+    }
+
+    int count_columns() const { return columns_; }
+    int count_cards() const { return start_[columns_]; }
+
+    // Playing in column m is the same as playing in column mirror_move(m)
+    // on the horizontally flipped board; this maps -1 to the far right and back.
+    int mirror_move(int m) const { return columns_ - 1 - m; }
+
+    bool is_mirror_symmetric() const {
+        int n = columns_;
+        for (int i=0; i < n/2; ++i) {
+            if (!(column(i) == column(n-1-i))) return false;
+        }
+        return true;
+    }
 
     void apply_in_place(int column, Card card) {
-        if (column == -1) {
-            columns_.emplace_back();
-            std::rotate(columns_.begin(), columns_.end()-1, columns_.end());
-            assert(columns_.front().empty());
-            columns_.front().emplace_back(card);
-        } else if (column == columns_.size()) {
-            columns_.emplace_back();
-            columns_.back().emplace_back(card);
+        assert(-1 <= column && column <= columns_);
+        assert(count_cards() < max_cards);
+        int n = columns_;
+        int total = start_[n];
+        if (column == n) {
+            cards_[total] = card;
+            start_[n+1] = total + 1;
+            columns_ = n + 1;
+        } else if (column == -1) {
+            std::copy_backward(cards_, cards_ + total, cards_ + total + 1);
+            cards_[0] = card;
+            for (int x = n; x >= 0; --x) {
+                start_[x+1] = start_[x] + 1;
+            }
+            start_[0] = 0;
+            columns_ = n + 1;
         } else {
-            assert(0 <= column && column < columns_.size());
-            columns_[column].emplace_back(card);
+            int pos = start_[column+1];
+            std::copy_backward(cards_ + pos, cards_ + total, cards_ + total + 1);
+            cards_[pos] = card;
+            for (int x = column+1; x <= n; ++x) {
+                start_[x] += 1;
+            }
         }
     }
 
-    Board apply(int column, Card card) const {
-        Board next = *this;
+    BasicBoard apply(int column, Card card) const {
+        BasicBoard next = *this;
         next.apply_in_place(column, card);
         return next;
     }
 
     std::string toString() const {
         int max_y = 2;
-        for (int x=0; x < columns_.size(); ++x) {
-            max_y = std::max(max_y, columns_[x].size());
+        for (int x=0; x < columns_; ++x) {
+            max_y = std::max(max_y, height(x));
         }
         std::string result;
         for (int y = max_y; y >= 0; --y) {
             result += "..";
-            for (int x = 0; x < columns_.size(); ++x) {
+            for (int x = 0; x < columns_; ++x) {
                 result += ' ';
                 result += cardAt(x, y).toString();
             }
@@ -142,10 +183,10 @@ public:
     }
 
     nibble_writer toPacked(nibble_writer it, bool flipHorizontal) const {
-        for (int i=0; i < int(columns_.size()); ++i) {
-            const Column& col = flipHorizontal ? columns_[columns_.size() - i - 1] : columns_[i];
-            for (int j=0; j < col.size(); ++j) {
-                it = col[j].toPacked(it);
+        for (int i=0; i < columns_; ++i) {
+            int x = flipHorizontal ? columns_ - i - 1 : i;
+            for (int j = start_[x]; j < start_[x+1]; ++j) {
+                it = cards_[j].toPacked(it);
             }
             it = Card().toPacked(it);
         }
@@ -153,42 +194,44 @@ public:
     }
 
 private:
+    int height(int x) const { return start_[x+1] - start_[x]; }
+
     Card cardAt(int x, int y) const {
-        if (0 <= x && x < columns_.size()) {
-            if (0 <= y && y < columns_[x].size()) {
-                return columns_[x][y];
+        if (0 <= x && x < columns_) {
+            if (0 <= y && y < height(x)) {
+                return cards_[start_[x] + y];
             }
         }
         return Card();
     }
 
-    bool is_vertical_win_involving(int x, Color who) const {
+    int vertical_sum_involving(int x, Color who) const {
         int sum = 0;
-        for (int y = columns_[x].size() - 1; y >= 0; --y) {
+        for (int y = height(x) - 1; y >= 0; --y) {
             Card card = cardAt(x, y);
             if (card.color() != who) break;
             sum += card.value();
         }
-        return sum >= 15;
+        return sum;
     }
-    bool is_horizontal_win_involving(int column, Color who) const {
+    int horizontal_sum_involving(int column, Color who) const {
         int sum = 0;
-        int y = columns_[column].size() - 1;
+        int y = height(column) - 1;
         for (int x = column; x >= 0; --x) {
             Card card = cardAt(x, y);
             if (card.color() != who) break;
             sum += card.value();
         }
-        for (int x = column+1; x < columns_.size(); ++x) {
+        for (int x = column+1; x < columns_; ++x) {
             Card card = cardAt(x, y);
             if (card.color() != who) break;
             sum += card.value();
         }
-        return sum >= 15;
+        return sum;
     }
-    bool is_slash_win_involving(int x, Color who) const {
+    int slash_sum_involving(int x, Color who) const {
         int sum = 0;
-        int y = columns_[x].size() - 1;
+        int y = height(x) - 1;
         for (int d = 0; true; ++d) {
             Card card = cardAt(x+d, y+d);
             if (card.color() != who) break;
@@ -199,11 +242,11 @@ private:
             if (card.color() != who) break;
             sum += card.value();
         }
-        return sum >= 15;
+        return sum;
     }
-    bool is_backslash_win_involving(int x, Color who) const {
+    int backslash_sum_involving(int x, Color who) const {
         int sum = 0;
-        int y = columns_[x].size() - 1;
+        int y = height(x) - 1;
         for (int d = 0; true; ++d) {
             Card card = cardAt(x+d, y-d);
             if (card.color() != who) break;
@@ -214,7 +257,7 @@ private:
             if (card.color() != who) break;
             sum += card.value();
         }
-        return sum >= 15;
+        return sum;
     }
 
 public:
@@ -222,26 +265,22 @@ public:
         if (column == -1) {
             column = 0;
         }
-        assert(columns_[column].topmost() == card);
+        assert(cards_[start_[column+1] - 1] == card);
         Color who = card.color();
         return (
-            is_vertical_win_involving(column, who) ||
-            is_horizontal_win_involving(column, who) ||
-            is_slash_win_involving(column, who) ||
-            is_backslash_win_involving(column, who)
+            vertical_sum_involving(column, who) >= R::target_sum ||
+            horizontal_sum_involving(column, who) >= R::target_sum ||
+            slash_sum_involving(column, who) >= R::target_sum ||
+            backslash_sum_involving(column, who) >= R::target_sum
         );
     }
 
-    struct ForcedMove {
-        bool is_forced;
-        bool is_double_threat;
-        int move;
-    };
+    using ForcedMove = ::ForcedMove;
 
     ForcedMove must_respond_to_threat(Card card) const {
         ForcedMove result = { false, false, 0 };
-        for (int column = -1; column <= int(columns_.size()); ++column) {
-            Board next = apply(column, card);
+        for (int column = -1; column <= columns_; ++column) {
+            BasicBoard next = apply(column, card);
             if (next.is_win_involving(column, card)) {
                 if (result.is_forced) {
                     // There are two threats! Checkmate!
@@ -253,4 +292,54 @@ public:
         }
         return result;
     }
+
+    // For every move at once, the least value of one color's card that
+    // wins by playing there: a card's own value just adds to the lines
+    // through it, so one scan of the board answers for every value.
+    struct WinningValues {
+        int columns;
+        int8_t least[max_cards + 2];  // by move + 1; past max_value if no card wins there
+
+        bool wins(int column, int v) const { return least[column+1] <= v; }
+
+        // The same answer as must_respond_to_threat(Card(who, v)).
+        ForcedMove threat(int v) const {
+            ForcedMove result = { false, false, 0 };
+            for (int column = -1; column <= columns; ++column) {
+                if (wins(column, v)) {
+                    if (result.is_forced) {
+                        return { true, true, result.move };
+                    }
+                    result = { true, false, column };
+                }
+            }
+            return result;
+        }
+    };
+
+    WinningValues winning_values(Color who) const {
+        WinningValues result;
+        result.columns = columns_;
+        for (int column = -1; column <= columns_; ++column) {
+            // A card of value zero stands in for them all.
+            BasicBoard next = apply(column, Card(who, 0));
+            int x = (column == -1) ? 0 : column;
+            int sum = std::max({
+                next.vertical_sum_involving(x, who),
+                next.horizontal_sum_involving(x, who),
+                next.slash_sum_involving(x, who),
+                next.backslash_sum_involving(x, who),
+            });
+            result.least[column+1] = std::min(std::max(R::target_sum - sum, 1), R::max_value + 1);
+        }
+        return result;
+    }
+
+private:
+    uint8_t columns_ = 0;
+    uint8_t start_[max_cards + 1] = {};  // column x is cards_[start_[x]] up to cards_[start_[x+1]]
+    Card cards_[max_cards];
 };
+
+using Board = BasicBoard<GameRules>;
+static_assert(sizeof(Board) <= 64 || Board::max_cards > 28, "Board should fit in a cache line");
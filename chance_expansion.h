@@ -0,0 +1,158 @@
+#pragma once
+
+#include <algorithm>
+#include <assert.h>
+#include <climits>
+
+#include "board_etc.h"
+#include "move_ordering.h"
+#include "state.h"
+
+// A chance node of the timed searches (ab-timed.cpp, ab-coro.cpp; their
+// move nodes are in move_expansion.h): the player who just moved draws
+// their next card, one of up to seven values (in the standard game; see
+// rules.h).
+// The positions after each draw share the board, the player to move and
+// that player's card; they differ only in the drawer's card, which matters
+// to the player to move only as a threat. So the expansion is done once
+// for all of them: one scan of the board finds which values threaten which
+// columns, and the mover's immediate win and move order are found once.
+// Then only the draws that need searching get a child of their own.
+
+struct ChanceExpansion {
+    struct Draw {
+        int value;
+        int weight;                // how many such cards are unseen
+        Board::ForcedMove threat;  // the drawer's, which the mover must answer
+    };
+
+    // What every child shares: the mover's moves, best first, and whether
+    // one of them wins outright, so that no threat matters.
+    struct Shared {
+        bool can_win = false;
+        int winning_move = 0;
+        int n = 0;
+        int moves[MoveOrdering::max_moves];
+    };
+
+    // `s` is the position just after a move, before the draw.
+    explicit ChanceExpansion(const State& s) : s_(s), drawer_(Color(1 - s.active_player())) {
+        for (int v = 1; v <= GameRules::max_value; ++v) {
+            int weight = s.count_unseen_cards(drawer_, v);
+            assert(0 <= weight && weight <= GameRules::copies);
+            if (weight != 0) {
+                draws_[count_++] = Draw{ v, weight, { false, false, 0 } };
+            }
+        }
+        if (count_ == 0) {
+            // The drawer's cards have run out; there's just the one position.
+            draws_[count_++] = Draw{ 0, 1, { false, false, 0 } };
+        }
+    }
+
+    // The work that only children to be searched need, so it's skipped
+    // at the leaves; `depth` is the children's, in the timed search's
+    // units of two per ply.
+    void expand(int depth) {
+        Card card = s_.top_card(s_.active_player());
+        if (card.color() == Nobody) {
+            return;  // a tie, whatever is drawn
+        }
+        const Board& board = s_.board();
+        auto mine = board.winning_values(card.color());
+        auto win = mine.threat(card.value());
+        shared_.can_win = win.is_forced;
+        shared_.winning_move = win.move;
+        if (!shared_.can_win) {
+            auto theirs = board.winning_values(drawer_);
+            for (int i=0; i < count_; ++i) {
+                if (draws_[i].value != 0) {
+                    draws_[i].threat = theirs.threat(draws_[i].value);
+                }
+            }
+        }
+        shared_.n = thread_move_ordering().ordered_moves(s_, depth / 2, shared_.moves);
+    }
+
+    // After expand(), whether a draw's value is known without searching
+    // it: a player to move who can win, will, and one facing two threats
+    // can't stop both.
+    bool is_settled(const Draw& d, double *value) const {
+        if (shared_.can_win) {
+            *value = INT_MAX;
+            return true;
+        } else if (d.threat.is_double_threat) {
+            *value = INT_MIN;
+            return true;
+        }
+        return false;
+    }
+
+    // The whole of a node's expansion, for both searches: fills values[i]
+    // for each draw i whose value is known without a search, or for every
+    // draw, by eval(), at a leaf, and calls add_child(i, d) for the rest.
+    // Returns how many values it filled.
+    template<class Eval, class AddChild>
+    int expand_children(int depth, bool is_leaf, Eval eval, double *values, AddChild add_child) {
+        if (!is_leaf) {
+            expand(depth);
+        }
+        int settled = 0;
+        for (int i=0; i < count_; ++i) {
+            const Draw& d = draws_[i];
+            if (is_leaf) {
+                values[i] = eval(after(d));
+                settled += 1;
+            } else if (is_settled(d, &values[i])) {
+                settled += 1;
+            } else {
+                add_child(i, d);
+            }
+        }
+        return settled;
+    }
+
+    int count() const { return count_; }
+    const Draw& draw(int i) const { return draws_[i]; }
+    const Shared& shared() const { return shared_; }
+
+    State after(const Draw& d) const {
+        State next = s_;
+        if (d.value != 0) {
+            next.draw_this_card(drawer_, d.value);
+        }
+        return next;
+    }
+
+    // The weighted average of the children's values, from the point of
+    // view of the player who drew, given each child's value from the
+    // point of view of the player to move.
+    template<class ValueOf>
+    double combine(ValueOf value_of) const {
+        bool all_his_losses = true;
+        bool any_his_win = false;
+        for (int i=0; i < count_; ++i) {
+            double v = value_of(i);
+            all_his_losses = all_his_losses && (v <= double(INT_MIN+1));
+            any_his_win = any_his_win || (v >= double(INT_MAX-1));
+        }
+        if (all_his_losses) {
+            return INT_MAX;
+        }
+        double ceiling = any_his_win ? 20 : INT_MAX;
+        double sum = 0;
+        int count = 0;
+        for (int i=0; i < count_; ++i) {
+            sum += draws_[i].weight * std::min(value_of(i), ceiling);
+            count += draws_[i].weight;
+        }
+        return -sum / count;
+    }
+
+private:
+    State s_;
+    Color drawer_;
+    int count_ = 0;
+    Draw draws_[GameRules::max_value];
+    Shared shared_;
+};
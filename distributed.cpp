@@ -0,0 +1,373 @@
+#include "distributed.h"
+
+#include <algorithm>
+#include <climits>
+#include <future>
+#include <netdb.h>
+#include <poll.h>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include "ab-timed.h"
+#include "opening_book.h"
+#include "position_text.h"
+#include "state.h"
+#include "threat_search.h"
+
+using Clock = std::chrono::steady_clock;
+using Result = std::pair<double, int>;
+
+static const std::chrono::seconds reply_grace_period(2);
+static const std::chrono::milliseconds hang_up_poll_interval(50);
+
+struct LineConnection {
+    std::string address_;
+    int fd_ = -1;
+    std::string buffer_;
+
+    explicit LineConnection(std::string address, int fd) : address_(std::move(address)), fd_(fd) {}
+    ~LineConnection() { close(); }
+
+    void close() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+        buffer_.clear();
+    }
+
+    bool write_line(const std::string& line) {
+        std::string data = line + "\n";
+        size_t sent = 0;
+        while (sent < data.size()) {
+#ifdef MSG_NOSIGNAL
+            ssize_t n = send(fd_, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+#else
+            ssize_t n = send(fd_, data.data() + sent, data.size() - sent, 0);
+#endif
+            if (n <= 0) {
+                return false;
+            }
+            sent += n;
+        }
+        return true;
+    }
+
+    // True if the other end has closed the connection, without waiting.
+    bool is_hung_up() {
+        struct pollfd pfd = { fd_, POLLIN, 0 };
+        if (poll(&pfd, 1, 0) <= 0) {
+            return false;
+        }
+        char c;
+        return recv(fd_, &c, 1, MSG_PEEK) <= 0;
+    }
+
+    bool read_line(std::string *line, Clock::time_point deadline) {
+        while (true) {
+            size_t eol = buffer_.find('\n');
+            if (eol != std::string::npos) {
+                *line = buffer_.substr(0, eol);
+                buffer_.erase(0, eol + 1);
+                return true;
+            }
+            int timeout_ms = -1;
+            if (deadline != Clock::time_point::max()) {
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+                timeout_ms = std::max(0, int(left.count()));
+            }
+            struct pollfd pfd = { fd_, POLLIN, 0 };
+            if (poll(&pfd, 1, timeout_ms) <= 0) {
+                return false;
+            }
+            char chunk[4096];
+            ssize_t n = recv(fd_, chunk, sizeof chunk, 0);
+            if (n <= 0) {
+                return false;
+            }
+            buffer_.append(chunk, n);
+        }
+    }
+};
+
+static void set_no_sigpipe(int fd)
+{
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof one);
+#else
+    (void)fd;
+#endif
+}
+
+// Calls f(fd, sockaddr, length) for each address that `address` names,
+// until f returns true; returns the socket that it accepted, or -1.
+template<class F>
+static int for_each_address(const std::string& address, bool passive, F f)
+{
+    if (address.compare(0, 5, "unix:") == 0) {
+        struct sockaddr_un sun;
+        memset(&sun, 0, sizeof sun);
+        sun.sun_family = AF_UNIX;
+        std::string path = address.substr(5);
+        if (path.empty() || path.size() >= sizeof sun.sun_path) {
+            fprintf(stderr, "%s: bad socket path\n", address.c_str());
+            return -1;
+        }
+        strcpy(sun.sun_path, path.c_str());
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && f(fd, (struct sockaddr *)&sun, sizeof sun)) {
+            return fd;
+        }
+        if (fd >= 0) close(fd);
+        return -1;
+    } else if (address.compare(0, 4, "tcp:") == 0) {
+        size_t colon = address.rfind(':');
+        std::string host = address.substr(4, colon - 4);
+        std::string port = address.substr(colon + 1);
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof hints);
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = passive ? AI_PASSIVE : 0;
+        struct addrinfo *ai = nullptr;
+        if (colon <= 4 || getaddrinfo(host.c_str(), port.c_str(), &hints, &ai) != 0) {
+            fprintf(stderr, "%s: bad address\n", address.c_str());
+            return -1;
+        }
+        int result = -1;
+        for (struct addrinfo *p = ai; p != nullptr && result < 0; p = p->ai_next) {
+            int fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+            if (fd >= 0 && f(fd, p->ai_addr, p->ai_addrlen)) {
+                result = fd;
+            } else if (fd >= 0) {
+                close(fd);
+            }
+        }
+        freeaddrinfo(ai);
+        return result;
+    }
+    fprintf(stderr, "%s: expected unix:<path> or tcp:<host>:<port>\n", address.c_str());
+    return -1;
+}
+
+int listen_on(const std::string& address)
+{
+    if (address.compare(0, 5, "unix:") == 0) {
+        unlink(address.c_str() + 5);
+    }
+    int fd = for_each_address(address, true, [](int fd, struct sockaddr *sa, socklen_t len) {
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+        return bind(fd, sa, len) == 0 && listen(fd, 16) == 0;
+    });
+    if (fd < 0) {
+        perror(address.c_str());
+    }
+    return fd;
+}
+
+int connect_to(const std::string& address)
+{
+    int fd = for_each_address(address, false, [](int fd, struct sockaddr *sa, socklen_t len) {
+        return connect(fd, sa, len) == 0;
+    });
+    if (fd >= 0) {
+        set_no_sigpipe(fd);
+    }
+    return fd;
+}
+
+static const char *eval_name(LeafEvaluationFunction eval)
+{
+    if (eval == simplest_eval) return "simplest";
+    if (eval == hashed_eval) return "hashed";
+    return nullptr;
+}
+
+static std::string handle_request(const std::string& line, const std::atomic<bool> *cancel)
+{
+    std::istringstream in(line);
+    std::string command, eval, moves_text, position;
+    int ms = 0;
+    int plies = 0;
+    if (!(in >> command >> eval >> ms >> plies >> moves_text) || command != "search") {
+        return "error expected: search <eval> <ms> <plies> <moves> <position>";
+    }
+    std::getline(in, position);
+
+    LeafEvaluationFunction f = (eval == "simplest") ? simplest_eval : (eval == "hashed") ? hashed_eval : nullptr;
+    if (f == nullptr) {
+        return "error unknown eval " + eval;
+    }
+    std::string error;
+    auto s = parse_position(position, &error);
+    if (s == nullptr) {
+        return "error " + error;
+    }
+    std::vector<int> moves;
+    std::istringstream ms_in(moves_text);
+    std::string m;
+    while (std::getline(ms_in, m, ',')) {
+        moves.push_back(atoi(m.c_str()));
+        if (moves.back() < -1 || moves.back() > s->count_columns()) {
+            return "error bad move " + m;
+        }
+    }
+    if (moves.empty()) {
+        return "error no moves";
+    }
+
+    SearchStats stats;
+    auto deadline = Clock::now() + std::chrono::milliseconds(ms);
+    Result r = evaluate_root_moves(f, *s, moves, plies, deadline, &stats, cancel);
+    char buf[128];
+    snprintf(buf, sizeof buf, "result %.17g %d %ld %d", r.first, r.second, stats.nodes, stats.depth);
+    return buf;
+}
+
+void serve_search_requests(int listen_fd)
+{
+    while (true) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+        set_no_sigpipe(fd);
+        // Each connection gets its own thread, so that one coordinator can't
+        // hold up another; their searches share the worker's thread pool.
+        std::thread([fd]() {
+            LineConnection c("", fd);
+            std::string line;
+            while (c.read_line(&line, Clock::time_point::max())) {
+                // A coordinator that gives up on us hangs up; stop searching
+                // for it then, rather than tie up the pool for nothing.
+                std::atomic<bool> cancel {false};
+                auto reply = std::async(std::launch::async, handle_request, line, &cancel);
+                while (reply.wait_for(hang_up_poll_interval) != std::future_status::ready) {
+                    if (!cancel && c.is_hung_up()) {
+                        cancel = true;
+                    }
+                }
+                if (!c.write_line(reply.get())) {
+                    break;
+                }
+            }
+        }).detach();
+    }
+}
+
+DistributedSearch::DistributedSearch(const std::vector<std::string>& worker_addresses,
+                                     std::chrono::milliseconds depth_timeout) :
+    depth_timeout_(depth_timeout)
+{
+    for (const auto& address : worker_addresses) {
+        workers_.push_back(std::make_unique<LineConnection>(address, connect_to(address)));
+        if (workers_.back()->fd_ < 0) {
+            fprintf(stderr, "%s: cannot connect; will retry\n", address.c_str());
+        }
+    }
+}
+
+DistributedSearch::~DistributedSearch() = default;
+
+Result DistributedSearch::evaluate(LeafEvaluationFunction eval, const State& s,
+                                   std::chrono::milliseconds timeout, int plies, SearchStats *stats)
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    auto deadline = Clock::now() + timeout;
+    assert(eval_name(eval) != nullptr);
+
+    auto search_locally = [&]() {
+        return (plies > 0) ? deterministically_evaluate(eval, s, plies, 0, stats)
+                           : recursively_evaluate(eval, s, timeout, stats);
+    };
+    if (s.is_tie_game() || s.count_columns() < 2) {
+        return search_locally();  // the search doesn't really search these
+    }
+    Result book;
+    if (plies == 0 && find_book_move(s, &book)) {
+        return book;  // as recursively_evaluate would
+    }
+    ProvenWin win = prove_forced_win(s);
+    if (win.is_proven) {
+        return { INT_MAX, win.move };
+    }
+
+    std::vector<LineConnection*> live;
+    for (auto&& w : workers_) {
+        if (w->fd_ < 0) {
+            w->fd_ = connect_to(w->address_);
+        }
+        if (w->fd_ >= 0) {
+            live.push_back(w.get());
+        }
+    }
+    if (live.empty()) {
+        return search_locally();
+    }
+
+    // Deal the root moves out like cards, skipping mirror images.
+    std::vector<std::vector<int>> shares(live.size());
+    std::vector<int> local_moves;
+    const bool is_symmetric = s.is_mirror_symmetric();
+    int k = 0;
+    for (int m = -1; m <= s.count_columns(); ++m) {
+        if (!(is_symmetric && s.mirror_move(m) < m)) {
+            shares[k++ % live.size()].push_back(m);
+        }
+    }
+
+    // A worker that hangs mustn't hang a search to a depth either.
+    const Clock::time_point reply_deadline = (plies > 0) ? Clock::now() + depth_timeout_ : deadline + reply_grace_period;
+    const std::string position = format_position(s);
+    for (int i=0; i < int(live.size()); ++i) {
+        if (shares[i].empty()) continue;
+        std::string moves;
+        for (int m : shares[i]) {
+            moves += (moves.empty() ? "" : ",") + std::to_string(m);
+        }
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+        std::string request = std::string("search ") + eval_name(eval) + " " + std::to_string(std::max(0, int(left.count()))) +
+                              " " + std::to_string(plies) + " " + moves + " " + position;
+        if (!live[i]->write_line(request)) {
+            fprintf(stderr, "%s: lost connection\n", live[i]->address_.c_str());
+            live[i]->close();
+            local_moves.insert(local_moves.end(), shares[i].begin(), shares[i].end());
+            shares[i].clear();
+        }
+    }
+
+    Result best = { INT_MIN, 0 };
+    SearchStats total;
+    for (int i=0; i < int(live.size()); ++i) {
+        if (shares[i].empty()) continue;
+        std::string reply;
+        Result r;
+        SearchStats w;
+        bool ok = live[i]->read_line(&reply, reply_deadline);
+        ok = ok && sscanf(reply.c_str(), "result %lf %d %ld %d", &r.first, &r.second, &w.nodes, &w.depth) == 4;
+        if (!ok) {
+            fprintf(stderr, "%s: no answer%s%s\n", live[i]->address_.c_str(), reply.empty() ? "" : ": ", reply.c_str());
+            live[i]->close();
+            local_moves.insert(local_moves.end(), shares[i].begin(), shares[i].end());
+            continue;
+        }
+        best = std::max(best, r);
+        total.nodes += w.nodes;
+        total.depth = std::max(total.depth, w.depth);
+    }
+    if (!local_moves.empty()) {
+        best = std::max(best, evaluate_root_moves(eval, s, local_moves, plies, deadline, &total));
+    }
+    if (stats != nullptr) {
+        stats->nodes += total.nodes;
+        stats->depth = std::max(stats->depth, total.depth);
+    }
+    return best;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "ab-timed.h"
+#include "state.h"
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A root-split search across processes, or machines. Each worker process
+// (see main-worker.cpp) listens on an address, either "unix:<path>" or
+// "tcp:<host>:<port>", and searches whatever root moves it is sent with
+// its own thread pool. The coordinator splits the root moves among its
+// workers, and takes the best of their results, which is the same result
+// the whole search would give.
+//
+// The protocol is one line each way per search:
+//
+//     search <eval> <ms> <plies> <move>,<move>,... <position, as in position_text.h>
+//     result <value> <move> <nodes> <depth>
+//
+// where <eval> is "simplest" or "hashed", and the search is deterministic
+// to <plies> if that's positive, or timed for <ms> otherwise. The deadline
+// is the coordinator's: each worker is sent the time remaining. A worker
+// that can't be reached, or doesn't answer in time, is dropped, and its
+// moves are searched locally. In time means by the deadline, plus a grace
+// period, or for a search to a depth, within the depth timeout. Giving up
+// on a worker closes its connection, which stops its search.
+
+struct LineConnection;
+
+int listen_on(const std::string& address);
+int connect_to(const std::string& address);
+
+// A worker's main loop: serves connections, each on its own thread, forever.
+void serve_search_requests(int listen_fd);
+
+class DistributedSearch {
+public:
+    explicit DistributedSearch(const std::vector<std::string>& worker_addresses,
+                               std::chrono::milliseconds depth_timeout = std::chrono::minutes(1));
+    DistributedSearch(const DistributedSearch&) = delete;
+    DistributedSearch& operator=(const DistributedSearch&) = delete;
+    ~DistributedSearch();
+
+    int count_workers() const { return workers_.size(); }
+
+    // Like recursively_evaluate, or deterministically_evaluate to `plies`
+    // if that's positive. One search at a time; concurrent callers wait.
+    std::pair<double, int> evaluate(LeafEvaluationFunction eval, const State& s,
+                                    std::chrono::milliseconds timeout, int plies, SearchStats *stats = nullptr);
+
+private:
+    std::vector<std::unique_ptr<LineConnection>> workers_;
+    std::chrono::milliseconds depth_timeout_;
+    std::mutex mtx_;
+};
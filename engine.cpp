@@ -0,0 +1,111 @@
+#include "engine.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <map>
+#include <stdlib.h>
+#include <utility>
+#include "ab-timed.h"
+#include "state.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct RegisteredEngine {
+    std::string description;
+    EngineFactory factory;
+};
+
+// A function-local static, so that registrations from other files' static
+// initializers find it constructed whatever order those run in.
+static std::map<std::string, RegisteredEngine>& registry()
+{
+    static std::map<std::string, RegisteredEngine> engines;
+    return engines;
+}
+
+EngineRegistration::EngineRegistration(const char *name, const char *description, EngineFactory factory)
+{
+    bool inserted = registry().emplace(name, RegisteredEngine{description, factory}).second;
+    assert(inserted);
+}
+
+std::unique_ptr<Engine> make_engine(const std::string& name, LeafEvaluationFunction eval)
+{
+    auto it = registry().find(name);
+    if (it == registry().end()) {
+        return nullptr;
+    }
+    return it->second.factory(eval);
+}
+
+void print_engines(FILE *fp)
+{
+    for (auto&& kv : registry()) {
+        fprintf(fp, "  %-12s %s\n", kv.first.c_str(), kv.second.description.c_str());
+    }
+}
+
+bool parse_search_limits(const std::string& text, SearchLimits *limits)
+{
+    *limits = SearchLimits();
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t plus = std::min(text.find('+', start), text.size());
+        std::string part = text.substr(start, plus - start);
+        char *end = nullptr;
+        long n = strtol(part.c_str(), &end, 10);
+        std::string unit = end;
+        if (end == part.c_str() || n <= 0) {
+            return false;
+        } else if (unit == "" || unit == "ms") {
+            limits->time = std::chrono::milliseconds(n);
+        } else if (unit == "plies" || unit == "ply") {
+            limits->plies = n;
+        } else if (unit == "nodes") {
+            limits->nodes = n;
+        } else {
+            return false;
+        }
+        start = plus + 1;
+    }
+    return limits->plies > 0 || limits->nodes > 0 || limits->time.count() > 0;
+}
+
+// The timed search (ab-timed.cpp) runs on its shared thread pool. It's
+// deterministic given a node budget, or a depth alone; otherwise it stops
+// at the deadline. A node budget ignores the clock, so it can't have both.
+class TimedEngine : public Engine {
+public:
+    explicit TimedEngine(LeafEvaluationFunction eval) : eval_(eval) {}
+
+    bool supports(const SearchLimits& limits) const override {
+        return limits.nodes == 0 || limits.time.count() == 0;
+    }
+
+    SearchResult search(const State& s, const SearchLimits& limits) const override {
+        assert(supports(limits));
+        SearchResult result;
+        std::pair<double, int> vm;
+        if (limits.nodes > 0) {
+            vm = deterministically_evaluate(eval_, s, limits.plies, limits.nodes, &result.stats);
+        } else if (limits.plies > 0 && limits.time.count() == 0) {
+            vm = deterministically_evaluate(eval_, s, limits.plies, 0, &result.stats);
+        } else if (limits.plies > 0) {
+            bool finished = false;
+            vm = evaluate_to_depth(eval_, s, limits.plies, Clock::now() + limits.time, &finished, &result.stats);
+        } else {
+            assert(limits.time.count() > 0);
+            vm = recursively_evaluate(eval_, s, limits.time, &result.stats);
+        }
+        result.value = vm.first;
+        result.move = vm.second;
+        return result;
+    }
+
+private:
+    LeafEvaluationFunction eval_;
+};
+
+static EngineRegistration timed_registration(
+    "timed", "parallel expectimax: deterministic to a depth or node budget, or else timed",
+    [](LeafEvaluationFunction eval) -> std::unique_ptr<Engine> { return std::make_unique<TimedEngine>(eval); });
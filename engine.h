@@ -0,0 +1,60 @@
+#pragma once
+
+#include "ab-timed.h"
+#include "state.h"
+#include <chrono>
+#include <memory>
+#include <stdio.h>
+#include <string>
+
+// The searches behind one interface, so that the drivers can pick one by
+// name at run time and compare them in the same binary. An engine searches
+// a State within SearchLimits: to a depth, within a node budget, or for a
+// time, whichever comes first; zero means no limit of that kind. Not every
+// engine honors every kind of limit; the drivers ask supports() first, and
+// turn down the limits an engine doesn't.
+//
+// Engines register themselves by name, from their own source files:
+//
+//     static EngineRegistration registration("name", "description", factory);
+//
+// so a binary offers whichever engines it links in.
+
+struct SearchLimits {
+    int plies = 0;
+    long nodes = 0;
+    std::chrono::milliseconds time {0};
+};
+
+struct SearchResult {
+    int move = 0;
+    double value = 0;
+    SearchStats stats;
+};
+
+class Engine {
+public:
+    virtual ~Engine() = default;
+
+    // May be called from several threads at once, with limits it supports.
+    virtual SearchResult search(const State& s, const SearchLimits& limits) const = 0;
+
+    // Whether search() honors every limit given, rather than ignoring some.
+    virtual bool supports(const SearchLimits& limits) const { return true; }
+};
+
+using EngineFactory = std::unique_ptr<Engine>(*)(LeafEvaluationFunction eval);
+
+struct EngineRegistration {
+    EngineRegistration(const char *name, const char *description, EngineFactory factory);
+};
+
+// Returns nullptr for an unknown name.
+std::unique_ptr<Engine> make_engine(const std::string& name, LeafEvaluationFunction eval = simplest_eval);
+
+// One line per engine, "  name  description", in order of name.
+void print_engines(FILE *fp);
+
+// "150ms", "4plies" or "20000nodes"; a plain number is milliseconds.
+// Limits of different kinds combine with '+', as in "4plies+150ms".
+bool parse_search_limits(const std::string& text, SearchLimits *limits);
@@ -0,0 +1,93 @@
+#include "game_log.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+
+static const uint8_t game_marker = 0xC1;
+static const size_t buffer_size = 1 << 16;
+
+GameLogWriter::GameLogWriter(const char *filename)
+{
+    fp_ = fopen(filename, "a");
+    assert(fp_ != nullptr);
+    buffer_.reserve(buffer_size);
+}
+
+GameLogWriter::~GameLogWriter()
+{
+    flush();
+    fclose(fp_);
+}
+
+void GameLogWriter::write(const GameRecord& g)
+{
+    assert(g.plies.size() <= 255);
+    buffer_.push_back(game_marker);
+    for (int i=0; i < 4; ++i) {
+        buffer_.push_back(g.seed >> (8*i));
+    }
+    buffer_.push_back(g.first_values[Red]);
+    buffer_.push_back(g.first_values[Black]);
+    buffer_.push_back(g.matchbox_color);
+    buffer_.push_back(g.plies.size());
+    for (const auto& ply : g.plies) {
+        buffer_.push_back((ply.move + 1) | (ply.by_matchbox ? 0x80 : 0));
+        buffer_.push_back(ply.drawn_value);
+        buffer_.push_back(ply.definitely_best_move + 2);
+    }
+    buffer_.push_back(g.winner);
+    if (buffer_.size() >= buffer_size) {
+        flush();
+    }
+}
+
+void GameLogWriter::flush()
+{
+    fwrite(buffer_.data(), 1, buffer_.size(), fp_);
+    fflush(fp_);
+    buffer_.clear();
+}
+
+GameLogReader::GameLogReader(const char *filename)
+{
+    fp_ = fopen(filename, "r");
+    if (fp_ != nullptr) {
+        setvbuf(fp_, nullptr, _IOFBF, buffer_size);
+    }
+}
+
+GameLogReader::~GameLogReader()
+{
+    if (fp_ != nullptr) {
+        fclose(fp_);
+    }
+}
+
+bool GameLogReader::next(GameRecord& g)
+{
+    uint8_t header[9];
+    if (fp_ == nullptr || fread(header, 1, 9, fp_) != 9) {
+        return false;
+    }
+    assert(header[0] == game_marker);
+    g.seed = header[1] | (header[2] << 8) | (header[3] << 16) | (uint32_t(header[4]) << 24);
+    g.first_values[Red] = header[5];
+    g.first_values[Black] = header[6];
+    g.matchbox_color = Color(header[7]);
+    int n = header[8];
+
+    uint8_t body[3 * 255 + 1];
+    if (fread(body, 1, 3*n + 1, fp_) != size_t(3*n + 1)) {
+        return false;  // a game torn by a crash
+    }
+    g.plies.resize(n);
+    for (int i=0; i < n; ++i) {
+        g.plies[i].move = (body[3*i] & 0x7F) - 1;
+        g.plies[i].by_matchbox = (body[3*i] & 0x80) != 0;
+        g.plies[i].drawn_value = body[3*i + 1];
+        g.plies[i].definitely_best_move = body[3*i + 2] - 2;
+    }
+    g.winner = Color(body[3*n]);
+    return true;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "board_etc.h"
+#include "state.h"
+
+// A compact binary record of one game, from which the game can be replayed
+// exactly: the seed, each side's first card, and for each ply the move, the
+// value of the card the mover drew next (0 if none were left), and what the
+// training loop learned from it. On disk, a game is
+//
+//     0xC1  uint32 seed (little-endian)  first red value  first black value
+//     matchbox's color  number of plies  three bytes per ply  winner
+//
+// where each ply is (move+1 | 0x80 if the matchbox player picked it),
+// the drawn value, and (definitely best move+2, or 0 if there was none).
+
+struct GameRecord {
+    struct Ply {
+        int move;
+        int drawn_value;
+        int definitely_best_move;  // -2 if none
+        bool by_matchbox;
+    };
+
+    uint32_t seed = 0;
+    int first_values[2] = {};
+    Color matchbox_color = Nobody;
+    Color winner = Nobody;
+    std::vector<Ply> plies;
+
+    State initial_state() const {
+        return State::initial(first_values[Red], first_values[Black]);
+    }
+};
+
+class GameLogWriter {
+public:
+    explicit GameLogWriter(const char *filename);
+    GameLogWriter(const GameLogWriter&) = delete;
+    GameLogWriter& operator=(const GameLogWriter&) = delete;
+    ~GameLogWriter();
+
+    void write(const GameRecord& g);
+    void flush();
+
+private:
+    FILE *fp_;
+    std::vector<uint8_t> buffer_;
+};
+
+class GameLogReader {
+public:
+    explicit GameLogReader(const char *filename);
+    GameLogReader(const GameLogReader&) = delete;
+    GameLogReader& operator=(const GameLogReader&) = delete;
+    ~GameLogReader();
+
+    bool is_open() const { return fp_ != nullptr; }
+    bool next(GameRecord& g);
+
+private:
+    FILE *fp_;
+};
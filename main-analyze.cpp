@@ -0,0 +1,189 @@
+#include "ab-timed.h"
+#include "distributed.h"
+#include "engine.h"
+#include "position_text.h"
+#include "state.h"
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+// Usage: ./analyze [--ms N | --depth N | --nodes N] [--engine NAME] [--jobs N] [--workers A,B... [--worker-timeout MS]] [--json] positions.txt
+//
+// Analyzes each position in the file (one per line, in the format of
+// position_text.h; blank lines and lines starting with '#' are skipped)
+// and prints one result per position, in input order, as CSV or as JSON
+// lines. The default budget is a deterministic search to depth 4, which
+// gives the same answers on every run; --ms uses the timed search instead.
+// --engine picks another engine from engine.h than "timed". With
+// --workers, each search is split among worker processes at those
+// addresses (see distributed.h), one position at a time. A worker that
+// hasn't answered a search to a depth within --worker-timeout (a minute by
+// default) is dropped, and its moves are searched locally.
+
+struct Job {
+    int line;
+    std::string text;
+};
+
+static std::string format_result(const Job& job, std::pair<double, int> vm, const SearchStats& stats, bool json)
+{
+    char value[32];
+    if (vm.first == INT_MAX) {
+        snprintf(value, sizeof value, json ? "\"win\"" : "win");
+    } else {
+        snprintf(value, sizeof value, "%.6g", vm.first);
+    }
+    char buf[128];
+    if (json) {
+        snprintf(buf, sizeof buf, "{\"line\": %d, \"best_move\": %d, \"value\": %s, \"depth\": %d, \"nodes\": %ld}\n",
+                 job.line, vm.second, value, stats.depth, stats.nodes);
+    } else {
+        snprintf(buf, sizeof buf, "%d,%d,%s,%d,%ld\n", job.line, vm.second, value, stats.depth, stats.nodes);
+    }
+    return buf;
+}
+
+int main(int argc, char **argv)
+{
+    int ms = 0;
+    int plies = 4;
+    long nodes = 0;
+    int concurrency = std::max(1u, std::thread::hardware_concurrency());
+    bool json = false;
+    const char *filename = nullptr;
+    std::vector<std::string> workers;
+    std::string engine_name = "timed";
+    int worker_timeout_ms = 60000;
+    for (int i=1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--ms") && i+1 < argc) {
+            ms = atoi(argv[++i]);
+            plies = 0;
+        } else if (!strcmp(argv[i], "--depth") && i+1 < argc) {
+            plies = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--nodes") && i+1 < argc) {
+            nodes = atol(argv[++i]);
+            plies = 0;
+        } else if (!strcmp(argv[i], "--engine") && i+1 < argc) {
+            engine_name = argv[++i];
+        } else if (!strcmp(argv[i], "--jobs") && i+1 < argc) {
+            concurrency = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--workers") && i+1 < argc) {
+            std::string list = argv[++i];
+            for (size_t start = 0, comma; start <= list.size(); start = comma + 1) {
+                comma = std::min(list.find(',', start), list.size());
+                workers.push_back(list.substr(start, comma - start));
+            }
+        } else if (!strcmp(argv[i], "--worker-timeout") && i+1 < argc) {
+            worker_timeout_ms = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--json")) {
+            json = true;
+        } else if (argv[i][0] != '-' && filename == nullptr) {
+            filename = argv[i];
+        } else {
+            filename = nullptr;
+            break;
+        }
+    }
+    std::unique_ptr<Engine> engine = make_engine(engine_name, hashed_eval);
+    if (filename == nullptr || (ms <= 0 && plies <= 0 && nodes <= 0) || engine == nullptr || worker_timeout_ms <= 0 ||
+        (!workers.empty() && (nodes > 0 || engine_name != "timed"))) {
+        fprintf(stderr, "Usage: %s [--ms N | --depth N | --nodes N] [--engine NAME] [--jobs N] [--workers A,B... [--worker-timeout MS]] [--json] positions.txt\n", argv[0]);
+        fprintf(stderr, "(--workers works only with the timed engine, and not with --nodes.) The engines are:\n");
+        print_engines(stderr);
+        return 1;
+    }
+    SearchLimits limits;
+    limits.plies = plies;
+    limits.nodes = nodes;
+    limits.time = std::chrono::milliseconds(ms);
+    if (!engine->supports(limits)) {
+        fprintf(stderr, "%s: the %s engine can't search within these limits. The engines are:\n", argv[0], engine_name.c_str());
+        print_engines(stderr);
+        return 1;
+    }
+
+    std::ifstream in(filename);
+    if (!in) {
+        fprintf(stderr, "%s: cannot open\n", filename);
+        return 1;
+    }
+    std::vector<Job> jobs;
+    std::string text;
+    for (int line = 1; std::getline(in, text); ++line) {
+        size_t first = text.find_first_not_of(" \t\r");
+        if (first == std::string::npos || text[first] == '#') {
+            continue;
+        }
+        jobs.push_back(Job{line, text});
+    }
+
+    set_search_threads(std::max(1u, std::thread::hardware_concurrency()));
+    std::unique_ptr<DistributedSearch> distributed;
+    if (!workers.empty()) {
+        distributed = std::make_unique<DistributedSearch>(workers, std::chrono::milliseconds(worker_timeout_ms));
+        concurrency = 1;
+    }
+
+    if (!json) {
+        printf("line,best_move,value,depth,nodes\n");
+    }
+    std::atomic<int> next_job {0};
+    std::mutex mtx;
+    std::map<int, std::string> finished;
+    int next_to_print = 0;
+    int errors = 0;
+
+    auto worker = [&]() {
+        while (true) {
+            int i = next_job++;
+            if (i >= int(jobs.size())) break;
+            std::string output;
+            std::string error;
+            auto s = parse_position(jobs[i].text, &error);
+            if (s == nullptr) {
+                fprintf(stderr, "%s:%d: %s\n", filename, jobs[i].line, error.c_str());
+            } else {
+                SearchStats stats;
+                std::pair<double, int> vm;
+                if (distributed != nullptr) {
+                    vm = distributed->evaluate(hashed_eval, *s, std::chrono::milliseconds(ms), plies, &stats);
+                } else {
+                    SearchResult r = engine->search(*s, limits);
+                    vm = { r.value, r.move };
+                    stats = r.stats;
+                }
+                output = format_result(jobs[i], vm, stats, json);
+            }
+
+            // Print in input order, however the jobs happen to finish.
+            std::lock_guard<std::mutex> lk(mtx);
+            errors += (s == nullptr);
+            finished[i] = std::move(output);
+            while (!finished.empty() && finished.begin()->first == next_to_print) {
+                fputs(finished.begin()->second.c_str(), stdout);
+                finished.erase(finished.begin());
+                next_to_print += 1;
+            }
+            fflush(stdout);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i=0; i < concurrency; ++i) {
+        threads.emplace_back(worker);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    return (errors != 0) ? 1 : 0;
+}
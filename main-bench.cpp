@@ -0,0 +1,235 @@
+#include "ab-timed.h"
+#include "engine.h"
+#include "reference.h"
+#include "state.h"
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Usage: ./bench [plies] [threads[,threads...]] [engine...]
+//
+// Runs each engine (see engine.h; "timed" by default) to a fixed depth over
+// a fixed set of positions. For the timed engine that's the deterministic
+// search, so the total node count is a signature of the search's behavior:
+// it changes only when the search itself changes, never with the thread
+// count or the machine. Nodes per second is the performance baseline.
+// Given several thread counts, such as 1,2,4,8,16,32, it runs each engine
+// with each, for scaling curves: the time to reach the depth, and the
+// nodes per second, by the number of threads. Built with
+// `make TRACING=1`, it also writes a timeline of the searches to trace.json.
+// Last, it times the board's kernels, such as the win check and packing,
+// beside their plain versions in reference.h, for a baseline per kernel.
+
+static std::vector<State> benchmark_positions()
+{
+    std::vector<State> positions;
+    // These use cards that a smaller variant (see rules.h) may not have.
+    if (std::is_same<GameRules, StandardRules>::value) {
+        positions.push_back(State(Red, Card("7r"), Card("4b"), Board({
+            { Card("3r"), Card("6b"), Card("5r"), Card("4r"), Card("1b"), Card("2r") },
+            { Card("1r"), Card("4b"), Card("6r"), Card("3b"), Card("2b"), Card("6r"), Card("4b"), Card("3r"), Card("5b"), Card("4r"), Card("7b"), Card("6b"), Card("2r"), Card("5b") },
+        })));
+        positions.push_back(State(Black, Card("7r"), Card("5b"), Board({
+            { Card("3r"), Card("6b"), Card("5r"), Card("4r"), Card("1b"), Card("2r") },
+            { Card("1r"), Card("4b"), Card("6r"), Card("3b"), Card("2b"), Card("6r"), Card("4b"), Card("3r"), Card("5b"), Card("4r"), Card("7b"), Card("6b"), Card("2r"), Card("5b") },
+        })));
+
+        positions.push_back(State(Red, Card("6r"), Card("1b"), Board({
+            { Card("2r"), Card("3b") },
+            { Card("4b") },
+            { Card("2r"), Card("3b") },
+        })));
+    }
+
+    // Midgame positions from seeded random playouts, skipping any that are
+    // decided on the spot by an immediate win or a forced block.
+    std::mt19937 rand(15);
+    while (positions.size() < 12) {
+        State s = State::initial(std::ref(rand));
+        int plies = 4 + rand() % 12;
+        bool over = false;
+        for (int i=0; i < plies && !over; ++i) {
+            int move = int(rand() % (s.count_columns() + 2)) - 1;
+            over = s.apply_in_place(std::ref(rand), move) || s.is_tie_game();
+        }
+        if (over || s.must_respond_to_threat().is_forced) {
+            continue;
+        }
+        bool can_win = false;
+        for (int m = -1; m <= s.count_columns(); ++m) {
+            can_win = can_win || State(s).apply_in_place_without_drawing(m);
+        }
+        if (!can_win) {
+            positions.push_back(s);
+        }
+    }
+    return positions;
+}
+
+// The search copies a State for every move it tries, so time that alone,
+// and then with the move and its win check.
+static void benchmark_copies(const std::vector<State>& positions)
+{
+    const int iterations = 1000000;
+    std::vector<State> copies(64, positions[0]);
+    auto start = std::chrono::steady_clock::now();
+    for (int i=0; i < iterations; ++i) {
+        copies[i % 64] = positions[i % positions.size()];
+    }
+    std::chrono::duration<double, std::nano> copy_only = std::chrono::steady_clock::now() - start;
+
+    long wins = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i=0; i < iterations; ++i) {
+        State& next = copies[i % 64];
+        next = positions[i % positions.size()];
+        wins += next.apply_in_place_without_drawing(i % (next.count_columns() + 2) - 1);
+    }
+    std::chrono::duration<double, std::nano> with_move = std::chrono::steady_clock::now() - start;
+    printf("sizeof(State) %d bytes: %.1f ns per copy, %.1f ns per copy and move (%ld wins)\n",
+           int(sizeof(State)), copy_only.count() / iterations, with_move.count() / iterations, wins);
+}
+
+// The board's kernels, each beside its plain version in reference.h (see
+// main-tests.cpp, which checks that they agree): the time per call, over
+// every move and card in the benchmark positions.
+// Sums the results into *checksum, so that they can't be optimized away.
+template<class F>
+static double ns_per_call(int calls, long *checksum, F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i=0; i < calls; ++i) {
+        *checksum += f(i);
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / calls;
+}
+
+static void benchmark_kernels(const std::vector<State>& positions)
+{
+    std::vector<reference::Columns> cols;
+    for (auto&& s : positions) {
+        cols.push_back(reference::columns_of(s.board()));
+    }
+    int n = positions.size();
+    auto move = [&](int i) { return i % (positions[i % n].count_columns() + 2) - 1; };
+    auto card = [&](int i) { return Card(Color(i / n % 2), 1 + i / n % GameRules::max_value); };
+    auto report = [](const char *kernel, double fast, double slow) {
+        printf("%-16s %8.1f ns per call, %8.1f ns for the reference\n", kernel, fast, slow);
+    };
+
+    const int calls = 1000000;
+    long checksum = 0;
+    const int reference_calls = calls / 10;
+    report("win check", ns_per_call(calls, &checksum, [&](int i) {
+        return positions[i % n].board().apply(move(i), card(i)).is_win_involving(move(i), card(i));
+    }), ns_per_call(reference_calls, &checksum, [&](int i) {
+        auto next = cols[i % n];
+        reference::play(next, move(i), card(i));
+        return reference::is_win_involving(next, move(i), card(i));
+    }));
+    report("forced move", ns_per_call(calls, &checksum, [&](int i) {
+        return positions[i % n].board().must_respond_to_threat(card(i)).move;
+    }), ns_per_call(reference_calls, &checksum, [&](int i) {
+        return reference::must_respond_to_threat(cols[i % n], card(i)).move;
+    }));
+    report("winning values", ns_per_call(calls / 10, &checksum, [&](int i) {
+        // Every value's threats, from one scan.
+        auto wv = positions[i % n].board().winning_values(Color(i / n % 2));
+        int sum = 0;
+        for (int v=1; v <= GameRules::max_value; ++v) {
+            sum += wv.threat(v).move;
+        }
+        return sum;
+    }), ns_per_call(reference_calls / 10, &checksum, [&](int i) {
+        int sum = 0;
+        for (int v=1; v <= GameRules::max_value; ++v) {
+            sum += reference::must_respond_to_threat(cols[i % n], Card(Color(i / n % 2), v)).move;
+        }
+        return sum;
+    }));
+    report("pack", ns_per_call(calls, &checksum, [&](int i) {
+        return positions[i % n].toPacked().data_[i % PackedState::size];
+    }), ns_per_call(reference_calls, &checksum, [&](int i) {
+        return reference::pack(positions[i % n], false).data_[i % PackedState::size];
+    }));
+    report("canonical pack", ns_per_call(calls, &checksum, [&](int i) {
+        return positions[i % n].toPackedCanonical().second;
+    }), ns_per_call(reference_calls, &checksum, [&](int i) {
+        return reference::pack_canonical(positions[i % n]).second;
+    }));
+    printf("(checksum %ld)\n", checksum);
+}
+
+int main(int argc, char **argv)
+{
+    const int plies = (argc > 1) ? atoi(argv[1]) : 3;
+    std::vector<int> thread_counts;
+    std::string list = (argc > 2) ? argv[2] : "4";
+    for (size_t start = 0, comma; start <= list.size(); start = comma + 1) {
+        comma = std::min(list.find(',', start), list.size());
+        thread_counts.push_back(std::max(1, atoi(list.substr(start, comma - start).c_str())));
+    }
+    std::vector<std::string> engines;
+    for (int i=3; i < argc; ++i) {
+        engines.push_back(argv[i]);
+    }
+    if (engines.empty()) {
+        engines.push_back("timed");
+    }
+
+    std::vector<State> positions = benchmark_positions();
+    for (auto&& name : engines) {
+        for (int threads : thread_counts) {
+            set_search_threads(threads);
+            // A new engine each time, so that Lazy SMP starts with an empty table.
+            std::unique_ptr<Engine> engine = make_engine(name, hashed_eval);
+            if (engine == nullptr) {
+                fprintf(stderr, "Unknown engine \"%s\"; the engines are:\n", name.c_str());
+                print_engines(stderr);
+                return 1;
+            }
+            SearchLimits limits;
+            limits.plies = plies;
+            if (!engine->supports(limits)) {
+                fprintf(stderr, "Engine \"%s\" can't search to a depth; the engines are:\n", name.c_str());
+                print_engines(stderr);
+                return 1;
+            }
+            long total_nodes = 0;
+            long peak_live_nodes = 0;
+            double total_ms = 0;
+            for (int i=0; i < int(positions.size()); ++i) {
+                auto start = std::chrono::steady_clock::now();
+                SearchResult r = engine->search(positions[i], limits);
+                long nodes = r.stats.nodes;
+                std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+                if (thread_counts.size() == 1) {
+                    printf("Position %2d: move %2d value %9.4f %9ld nodes %8.1f ms\n", i, r.move, r.value, nodes, elapsed.count());
+                }
+                total_nodes += nodes;
+                peak_live_nodes = std::max(peak_live_nodes, r.stats.peak_live_nodes);
+                total_ms += elapsed.count();
+            }
+            printf("%s, depth %d, %d threads: %ld nodes in %.1f ms, %.0f nodes/second",
+                   name.c_str(), plies, threads, total_nodes, total_ms, total_nodes / total_ms * 1000);
+            if (peak_live_nodes != 0) {
+                printf(", at most %ld live", peak_live_nodes);
+            }
+            printf("\n");
+        }
+    }
+    if (TRACE_DUMP("trace.json")) {
+        printf("Wrote the search's timeline to trace.json.\n");
+    }
+    benchmark_copies(positions);
+    benchmark_kernels(positions);
+}
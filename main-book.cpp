@@ -0,0 +1,112 @@
+#include "ab-timed.h"
+#include "opening_book.h"
+#include "packed_state.h"
+#include "state.h"
+#include <chrono>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <utility>
+
+// Usage: ./book [--plies N] [--nodes N] out.book
+//
+// Builds an opening book: every position in the first N plies of the game
+// (3 by default), over every possible card draw, each searched with a
+// node budget (1000000 by default). The search is deterministic, with
+// hashed_eval, so the same options always build the same book. Unlike
+// in play, the first two moves are searched like any other.
+
+static void usage()
+{
+    fprintf(stderr, "Usage: ./book [--plies N] [--nodes N] out.book\n");
+    exit(1);
+}
+
+// All the positions one ply after `level`, with either player's draw.
+static std::map<PackedState, State> next_level(const std::map<PackedState, State>& level)
+{
+    std::map<PackedState, State> result;
+    for (auto&& kv : level) {
+        const State& s = kv.second;
+        const bool is_symmetric = s.is_mirror_symmetric();
+        Color who = s.active_player();
+        for (int m = -1; m <= s.count_columns(); ++m) {
+            if (is_symmetric && s.mirror_move(m) < m) {
+                continue;
+            }
+            State moved = s;
+            if (moved.apply_in_place_without_drawing(m)) {
+                continue;  // the game is over
+            }
+            for (int v = 1; v <= GameRules::max_value; ++v) {
+                if (moved.count_unseen_cards(who, v) == 0) {
+                    continue;
+                }
+                State next = moved;
+                next.draw_this_card(who, v);
+                if (!next.is_tie_game()) {
+                    result.emplace(next.toPackedCanonical().first, next);
+                }
+            }
+        }
+    }
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    int plies = 3;
+    long nodes = 1000000;
+    std::string filename;
+    for (int i=1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--plies") && i+1 < argc) {
+            plies = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--nodes") && i+1 < argc) {
+            nodes = atol(argv[++i]);
+        } else if (argv[i][0] == '-' || !filename.empty()) {
+            usage();
+        } else {
+            filename = argv[i];
+        }
+    }
+    if (filename.empty() || plies < 1 || nodes < 1) {
+        usage();
+    }
+
+    std::map<PackedState, State> book_positions;
+    std::map<PackedState, State> level;
+    for (int r = 1; r <= GameRules::max_value; ++r) {
+        for (int b = 1; b <= GameRules::max_value; ++b) {
+            State s = State::initial(r, b);
+            level.emplace(s.toPackedCanonical().first, s);
+        }
+    }
+    for (int ply = 0; ply < plies; ++ply) {
+        fprintf(stderr, "ply %d: %zu positions\n", ply, level.size());
+        book_positions.insert(level.begin(), level.end());
+        if (ply + 1 < plies) {
+            level = next_level(level);
+        }
+    }
+
+    set_assume_opening_moves(false);
+    auto start = std::chrono::steady_clock::now();
+    OpeningBookWriter writer(filename);
+    long done = 0;
+    for (auto&& kv : book_positions) {
+        const State& s = kv.second;
+        auto vm = deterministically_evaluate(hashed_eval, s, 0, nodes);
+        // Store the move for the canonical orientation, as the key is.
+        bool flipped = s.toPackedCanonical().second;
+        writer.write(kv.first, vm.first, flipped ? s.mirror_move(vm.second) : vm.second);
+        done += 1;
+        if (done % 100 == 0 || done == long(book_positions.size())) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start);
+            fprintf(stderr, "%ld/%zu positions searched, %lds\n", done, book_positions.size(), long(elapsed.count()));
+        }
+    }
+    writer.finish();
+    printf("Wrote %zu positions to %s\n", book_positions.size(), filename.c_str());
+}
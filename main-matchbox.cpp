@@ -1,12 +1,17 @@
 #include "ab-timed.h"
+#include "game_log.h"
 #include "matchbox_player.h"
+#include "opening_book.h"
 #include "state.h"
+#include "time_manager.h"
 #include <functional>
 #include <iostream>
 #include <random>
 #include <stdlib.h>
 #include <time.h>
 
+#define MATCHBOX_MEMORY_CAP_MB 2048
+
 int wins[2][3] = {};
 
 int main(int argc, char **argv)
@@ -19,7 +24,10 @@ int main(int argc, char **argv)
     true_rand.seed(time(nullptr));
 
     MatchboxPlayer mp;
+    mp.set_memory_cap(size_t(MATCHBOX_MEMORY_CAP_MB) << 20);
     mp.load_from_file("matchboxes.dat");
+    load_opening_book("opening.book");  // if it's there; see main-book.cpp
+    GameLogWriter log("games.log");
 
 restart:
     std::mt19937 reproducible_rand;
@@ -28,10 +36,21 @@ restart:
     memset(wins, '\0', sizeof(wins));
 
     for (size_t games_played = 0; true; ++games_played) {
-        State s = State::initial(std::ref(reproducible_rand));
+        uint32_t game_seed = reproducible_rand();
+        std::mt19937 game_rand(game_seed);
+        State s = State::initial(std::ref(game_rand));
         Color mpColor = Color(games_played % 2);
         Color humanColor = play_versus_human ? Color(1 - mpColor) : Nobody;
 
+        GameRecord record;
+        record.seed = game_seed;
+        record.first_values[Red] = s.top_card(Red).value();
+        record.first_values[Black] = s.top_card(Black).value();
+        record.matchbox_color = mpColor;
+        int definitely_best_move = -2;
+        TimeManager bfs_clock(std::chrono::milliseconds(80));
+        TimeManager mp_clock(std::chrono::milliseconds(400));
+
         auto get_human_move = [&](const char *swho) {
             std::cout << swho << "'s move? " << std::flush;
             int move;
@@ -42,21 +61,26 @@ restart:
         };
 
         auto get_bfs_move = [&](const char *swho) {
-            auto vm = recursively_evaluate(simplest_eval, s, std::chrono::milliseconds(10));
+            auto vm = bfs_clock.evaluate(simplest_eval, s);
             std::cout << "AI thinks " << swho << "'s best move is " << vm.second << " (value " << vm.first << ").\n";
             printf("Scheduled %d tasks, ran %d tasks, search depth %d.\n",
                    recursively_scheduled_tasks, recursively_evaluated_tasks, max_search_depth.load());
             if (vm.first >= INT_MAX) {
                 mp.record_definitely_best_move(s, vm.second);
+                definitely_best_move = vm.second;
             }
             return vm.second;
         };
 
         auto get_mp_move = [&](const char *swho) {
-            auto vm = recursively_evaluate(simplest_eval, s, std::chrono::milliseconds(50));
+            // MP's own search looks first at the moves MP likes.
+            set_move_priors([&mp](const State& t, double *priors) { return mp.move_priors(t, priors); });
+            auto vm = mp_clock.evaluate(simplest_eval, s);
+            set_move_priors(nullptr);
             if (vm.first >= INT_MAX) {
                 std::cout << "AI sees the winning move " << vm.second << " and is forcing MP to take it.\n";
                 mp.record_definitely_best_move(s, vm.second);
+                definitely_best_move = vm.second;
             }
             auto pm = mp.pick_move(std::ref(true_rand), s);
             std::cout << "MP picked " << pm.move << " for " << swho << ".";
@@ -69,9 +93,11 @@ restart:
 
         for (Color who = Red; true; who = Color(1 - who)) {
 
+            definitely_best_move = -2;
             auto fm = s.must_respond_to_threat();
             if (fm.is_forced) {
                 mp.record_definitely_best_move(s, fm.move);
+                definitely_best_move = fm.move;
             }
 
             std::cout << s.toString() << "\n";
@@ -84,8 +110,10 @@ restart:
             } else {
                 move = get_bfs_move(swho);
             }
-            bool won = s.apply_in_place(std::ref(reproducible_rand), move);
+            bool won = s.apply_in_place(std::ref(game_rand), move);
+            record.plies.push_back({ move, s.top_card(who).value(), definitely_best_move, who == mpColor });
             if (won) {
+                record.winner = who;
                 std::cout << swho << " just won the game!\n";
                 wins[mpColor][who] += 1;
                 if (who == mpColor) {
@@ -101,12 +129,17 @@ restart:
                 break;
             }
         }
+        log.write(record);
 
         if (train_versus_ai) {
             printf("%*s Wins when MP plays red: R %d, B %d, Tie %d\n", 40, "", wins[0][Red], wins[0][Black], wins[0][Nobody]);
             printf("%*s                  black: R %d, B %d, Tie %d\n", 40, "", wins[1][Red], wins[1][Black], wins[1][Nobody]);
             if (games_played % 16 == 0) {
-                mp.save_to_file("matchboxes.dat");
+                mp.checkpoint_to_file("matchboxes.dat");
+                log.flush();
+                auto st = mp.stats();
+                printf("%*s Matchboxes: %zu of %zu (%zu MB), evicted %ld untouched and %ld trained in %ld passes\n", 40, "",
+                       st.entries, st.capacity, st.bytes >> 20, st.evicted_untouched, st.evicted_trained, st.evictions);
             }
             if (seed != 0 && games_played == 31) goto restart;
         }
@@ -0,0 +1,137 @@
+#include "matchbox_file.h"
+#include "matchbox_player.h"
+#include "packed_state.h"
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <queue>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// Usage: ./merge out.dat in1.dat in2.dat ...
+//
+// Combines any number of matchbox databases into one, in a single pass.
+// Sorted (version 1 or later) inputs are streamed, so memory use is
+// bounded by the number of inputs, not their size. Old-format inputs, and
+// inputs with a pending journal, have to be sorted in memory first.
+// A merged entry's visits are the sum of the inputs', and it was last seen
+// when any of them last saw it.
+
+using Choices = MatchboxPlayer::Choices;
+using Aging = MatchboxPlayer::Aging;
+
+struct Input {
+    std::string filename_;
+    std::unique_ptr<MatchboxFileReader> reader_;
+    std::map<PackedState, std::pair<Choices, Aging>> loaded_;
+    std::map<PackedState, std::pair<Choices, Aging>>::const_iterator it_;
+    PackedState key_;
+    Choices choices_;
+    Aging aging_;
+    bool started_ = false;
+
+    explicit Input(const std::string& filename) : filename_(filename) {
+        reader_ = std::make_unique<MatchboxFileReader>(filename);
+        if (!reader_->is_open()) {
+            fprintf(stderr, "%s: cannot open\n", filename.c_str());
+            exit(1);
+        }
+        std::string journal = filename + ".journal";
+        if (!reader_->is_sorted() || access(journal.c_str(), F_OK) == 0) {
+            fprintf(stderr, "%s: not a compacted database; sorting it in memory\n", filename.c_str());
+            PackedState key;
+            Choices choices;
+            Aging aging;
+            while (reader_->next(key, choices, &aging)) loaded_[key] = { choices, aging };
+            check(*reader_);
+            MatchboxFileReader j(journal);
+            while (j.next(key, choices, &aging)) loaded_[key] = { choices, aging };
+            reader_ = nullptr;
+            it_ = loaded_.begin();
+        }
+    }
+
+    void check(const MatchboxFileReader& r) const {
+        if (!r.checksum_ok()) {
+            fprintf(stderr, "%s: checksum mismatch; refusing to merge a corrupt file\n", filename_.c_str());
+            exit(1);
+        }
+    }
+
+    bool advance() {
+        if (reader_ != nullptr) {
+            PackedState prev = key_;
+            if (!reader_->next(key_, choices_, &aging_)) {
+                check(*reader_);
+                return false;
+            }
+            if (std::exchange(started_, true) && !(prev < key_)) {
+                fprintf(stderr, "%s: records out of order\n", filename_.c_str());
+                exit(1);
+            }
+            return true;
+        }
+        if (it_ == loaded_.end()) {
+            return false;
+        }
+        key_ = it_->first;
+        choices_ = it_->second.first;
+        aging_ = it_->second.second;
+        ++it_;
+        return true;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s out.dat in1.dat in2.dat ...\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<Input>> inputs;
+    for (int i=2; i < argc; ++i) {
+        inputs.push_back(std::make_unique<Input>(argv[i]));
+    }
+
+    // A min-heap of (key, input index); ties go to the earlier input,
+    // which is what makes Choices::merge's "first one wins" rule well-defined.
+    using Head = std::pair<PackedState, int>;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heap;
+    for (int i=0; i < int(inputs.size()); ++i) {
+        if (inputs[i]->advance()) {
+            heap.push({ inputs[i]->key_, i });
+        }
+    }
+
+    MatchboxFileWriter writer(argv[1]);
+    size_t records_in = 0;
+    size_t records_out = 0;
+    std::vector<Choices> group;
+    while (!heap.empty()) {
+        PackedState key = heap.top().first;
+        group.clear();
+        Aging aging;
+        while (!heap.empty() && heap.top().first == key) {
+            int i = heap.top().second;
+            heap.pop();
+            group.push_back(inputs[i]->choices_);
+            const Aging& a = inputs[i]->aging_;
+            aging.visits_ = std::min<uint64_t>(uint64_t(aging.visits_) + a.visits_, UINT32_MAX);
+            aging.last_seen_ = std::max(aging.last_seen_, a.last_seen_);
+            if (inputs[i]->advance()) {
+                heap.push({ inputs[i]->key_, i });
+            }
+        }
+        writer.write(key, Choices::merge(group.data(), group.size()), aging);
+        records_in += group.size();
+        records_out += 1;
+    }
+    writer.finish();
+    printf("Merged %zu records from %zu inputs into %zu records.\n", records_in, inputs.size(), records_out);
+}
@@ -0,0 +1,65 @@
+#include "game_log.h"
+#include "matchbox_player.h"
+#include "state.h"
+#include <chrono>
+#include <stdio.h>
+
+// Usage: ./replay matchboxes.dat games.log...
+//
+// Retrains a matchbox player from recorded games, without any searching:
+// each ply replays exactly the definitely-best moves and matchbox moves
+// that the training loop saw when it played the game. Start from an empty
+// database to retrain from scratch, e.g. after changing the learning rule.
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s matchboxes.dat games.log...\n", argv[0]);
+        return 1;
+    }
+
+    MatchboxPlayer mp;
+    mp.load_from_file(argv[1]);
+
+    long games = 0;
+    long positions = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i=2; i < argc; ++i) {
+        GameLogReader reader(argv[i]);
+        if (!reader.is_open()) {
+            fprintf(stderr, "%s: cannot open\n", argv[i]);
+            return 1;
+        }
+        GameRecord g;
+        while (reader.next(g)) {
+            State s = g.initial_state();
+            for (const auto& ply : g.plies) {
+                Color who = s.active_player();
+                if (ply.definitely_best_move != -2) {
+                    mp.record_definitely_best_move(s, ply.definitely_best_move);
+                }
+                if (ply.by_matchbox) {
+                    mp.record_move(s, ply.move);
+                }
+                s.apply_in_place_without_drawing(ply.move);
+                if (ply.drawn_value != 0) {
+                    s.draw_this_card(who, ply.drawn_value);
+                }
+            }
+            if (g.winner == Nobody) {
+                mp.record_tie_and_reset();
+            } else if (g.winner == g.matchbox_color) {
+                mp.record_win_and_reset();
+            } else {
+                mp.record_loss_and_reset();
+            }
+            games += 1;
+            positions += g.plies.size();
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    mp.save_to_file(argv[1]);
+    printf("Replayed %ld games, %ld positions in %.2f s (%.0f positions/second).\n",
+           games, positions, elapsed.count(), positions / elapsed.count());
+}
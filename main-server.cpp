@@ -0,0 +1,295 @@
+#include "ab-timed.h"
+#include "engine.h"
+#include "matchbox_player.h"
+#include "opening_book.h"
+#include "position_text.h"
+#include "state.h"
+#include "threat_search.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <thread>
+
+// Usage: ./server [--threads N] [--book FILE] [--matchboxes FILE]
+//
+// The timed search as a long-running process, for a GUI or a test harness
+// to drive over stdin and stdout, one command per line, so that the thread
+// pool, the opening book, the matchboxes and the move-ordering tables are
+// loaded once and stay warm from one search to the next. (To serve it on a
+// socket instead, run it under something like socat.) The commands:
+//
+//     position <position, as in position_text.h>
+//     position random <seed>     a new game, with the first cards drawn from the seed
+//     move <column> [<card>]     the card the mover draws next, such as "3r", or
+//                                ".." if they have none left; drawn at random if left out
+//     show                       replies "position <position>"
+//     eval hashed | simplest     the leaf evaluation; hashed, by default
+//     go <limits>                as parse_search_limits takes them, e.g. "4plies" or "500ms"
+//     stop                       ends the search early, with the best move of the
+//                                last ply it completed; it always completes the first
+//     quit
+//
+// Each command but stop is answered by one line, "ok ..." or "error ...",
+// except go. A search deepens a ply at a time, with a line
+//
+//     info depth <plies> move <move> value <value> nodes <nodes> time <ms>
+//
+// for each ply it completes, and ends with
+//
+//     bestmove <move> value <value> depth <plies> nodes <nodes> time <ms>
+//
+// Values are from the point of view of the player to move, "win" and
+// "loss" for proven ones. Given only a depth, or a node budget, the search
+// is deterministic, as in ./analyze; given a time, it's the timed search.
+// While it runs, anything but stop and quit is an error. At the end of the
+// input, the server waits for the search and then exits.
+
+using Clock = std::chrono::steady_clock;
+using Result = std::pair<double, int>;
+
+static std::mutex g_output_mtx;
+
+static void say(const std::string& line)
+{
+    std::lock_guard<std::mutex> lk(g_output_mtx);
+    fputs(line.c_str(), stdout);
+    fputc('\n', stdout);
+    fflush(stdout);
+}
+
+static std::string format_value(double v)
+{
+    if (v >= double(INT_MAX)) {
+        return "win";
+    } else if (v <= double(INT_MIN)) {
+        return "loss";
+    }
+    char buf[32];
+    snprintf(buf, sizeof buf, "%.6g", v);
+    return buf;
+}
+
+static std::string format_line(const char *what, Result r, int depth, long nodes, Clock::time_point start)
+{
+    long ms = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+    char buf[160];
+    if (!strcmp(what, "info")) {
+        snprintf(buf, sizeof buf, "info depth %d move %d value %s nodes %ld time %ld",
+                 depth, r.second, format_value(r.first).c_str(), nodes, ms);
+    } else {
+        snprintf(buf, sizeof buf, "%s %d value %s depth %d nodes %ld time %ld",
+                 what, r.second, format_value(r.first).c_str(), depth, nodes, ms);
+    }
+    return buf;
+}
+
+// Whether `who` can draw `card` next: ".." only once they have none left.
+static bool can_draw(const State& s, Color who, Card card)
+{
+    if (card.color() == Nobody) {
+        return s.count_unseen_cards(who) == 0;
+    }
+    return card.color() == who && s.count_unseen_cards(who, card.value()) != 0;
+}
+
+// Runs on its own thread, so that the main loop can take a stop. Returns
+// the bestmove line, which the caller says once it's ready for another go.
+static std::string search(LeafEvaluationFunction eval, const State& s, const SearchLimits& limits)
+{
+    auto start = Clock::now();
+    Result book;
+    if (limits.time.count() > 0 && find_book_move(s, &book)) {
+        // as recursively_evaluate() does; the other limits ask for a search
+        return format_line("bestmove", book, 0, 0, start);
+    }
+    ProvenWin win = prove_forced_win(s);
+    if (win.is_proven) {
+        return format_line("bestmove", { INT_MAX, win.move }, 0, 0, start);
+    }
+
+    SearchStats total;
+    Result best;
+    if (limits.nodes > 0) {
+        // deterministically_evaluate does its own deepening, to fit the budget.
+        best = deterministically_evaluate(eval, s, limits.plies, limits.nodes, &total);
+        say(format_line("info", best, total.depth, total.nodes, start));
+    } else {
+        auto deadline = (limits.time.count() > 0) ? start + limits.time : Clock::time_point::max();
+        int max_plies = (limits.plies > 0) ? limits.plies : GameRules::max_cards;
+        long prev_nodes = 0;
+        for (int plies = 1; plies <= max_plies; ++plies) {
+            SearchStats iteration;
+            bool finished = true;
+            Result r;
+            if (limits.time.count() > 0) {
+                r = evaluate_to_depth(eval, s, plies, deadline, &finished, &iteration);
+            } else {
+                r = deterministically_evaluate(eval, s, plies, 0, &iteration, &finished);
+            }
+            total.nodes += iteration.nodes;
+            if (!finished) {
+                break;  // keep the last iteration that completed
+            }
+            best = r;
+            total.depth = plies;
+            say(format_line("info", best, plies, total.nodes, start));
+            bool is_proven = (r.first >= double(INT_MAX) || r.first <= double(INT_MIN));
+            if (is_proven || iteration.nodes == prev_nodes) {
+                break;  // deeper searches can't change anything
+            }
+            prev_nodes = iteration.nodes;
+        }
+    }
+    return format_line("bestmove", best, total.depth, total.nodes, start);
+}
+
+int main(int argc, char **argv)
+{
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    const char *book_filename = "opening.book";
+    const char *matchbox_filename = nullptr;
+    for (int i=1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--threads") && i+1 < argc) {
+            threads = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--book") && i+1 < argc) {
+            book_filename = argv[++i];
+        } else if (!strcmp(argv[i], "--matchboxes") && i+1 < argc) {
+            matchbox_filename = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--threads N] [--book FILE] [--matchboxes FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    set_search_threads(threads);
+    load_opening_book(book_filename);  // if it's there; see main-book.cpp
+    MatchboxPlayer mp;
+    if (matchbox_filename != nullptr) {
+        mp.load_from_file(matchbox_filename);
+        set_move_priors([&mp](const State& t, double *priors) { return mp.move_priors(t, priors); });
+    }
+    std::atomic<bool> stop {false};
+    set_stop_flag(&stop);
+
+    std::mt19937 rand(0);
+    State s = State::initial(std::ref(rand));
+    bool is_won = false;
+    LeafEvaluationFunction eval = hashed_eval;
+
+    std::thread searcher;
+    std::atomic<bool> searching {false};
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        std::istringstream in(line);
+        std::string command;
+        if (!(in >> command)) {
+            continue;
+        }
+        if (command == "stop") {
+            stop = true;
+            continue;
+        } else if (command == "quit") {
+            stop = true;
+            break;
+        } else if (searching) {
+            say("error searching; stop first");
+            continue;
+        }
+        if (searcher.joinable()) {
+            searcher.join();
+        }
+
+        std::string rest;
+        std::getline(in >> std::ws, rest);
+        if (command == "position") {
+            std::istringstream words(rest);
+            std::string word;
+            unsigned long seed;
+            std::string error;
+            if (words >> word && word == "random") {
+                if (!(words >> seed)) {
+                    say("error expected a seed");
+                    continue;
+                }
+                rand.seed(seed);
+                s = State::initial(std::ref(rand));
+            } else if (auto p = parse_position(rest, &error)) {
+                s = *p;
+            } else {
+                say("error " + error);
+                continue;
+            }
+            is_won = false;
+            say("ok");
+        } else if (command == "move") {
+            std::istringstream words(rest);
+            int column;
+            std::string word;
+            Card card;
+            Color who = s.active_player();
+            bool ok = bool(words >> column);
+            bool has_card = ok && bool(words >> word);
+            if (!ok || (has_card && !parse_card(word, &card))) {
+                say("error expected a column, and maybe a card");
+            } else if (is_won || s.is_tie_game()) {
+                say("error the game is over");
+            } else if (column < -1 || column > s.count_columns()) {
+                say("error no such column");
+            } else if (has_card && !can_draw(s, who, card)) {
+                say("error " + word + " can't be drawn");
+            } else {
+                is_won = s.apply_in_place_without_drawing(column);
+                if (!has_card) {
+                    s.draw_random_card(std::ref(rand), who);
+                } else if (card.color() != Nobody) {
+                    s.draw_this_card(who, card.value());
+                }
+                say(is_won ? "ok win" : s.is_tie_game() ? "ok tie" : "ok " + s.top_card(who).toString());
+            }
+        } else if (command == "show") {
+            say("position " + format_position(s));
+        } else if (command == "eval") {
+            if (rest == "hashed") {
+                eval = hashed_eval;
+            } else if (rest == "simplest") {
+                eval = simplest_eval;
+            } else {
+                say("error expected hashed or simplest");
+                continue;
+            }
+            say("ok");
+        } else if (command == "go") {
+            SearchLimits limits;
+            if (!parse_search_limits(rest, &limits)) {
+                say("error bad limits '" + rest + "'");
+            } else if (is_won || s.is_tie_game()) {
+                say("error the game is over");
+            } else {
+                stop = false;
+                searching = true;
+                searcher = std::thread([&, s, limits]() {
+                    std::string done = search(eval, s, limits);
+                    searching = false;
+                    say(done);
+                });
+            }
+        } else {
+            say("error unknown command '" + command + "'");
+        }
+    }
+    if (searcher.joinable()) {
+        searcher.join();
+    }
+    set_stop_flag(nullptr);
+    set_move_priors(nullptr);
+}
@@ -1,10 +1,29 @@
+#include <atomic>
 #include <chrono>
+#include <functional>
 #include <iostream>
+#include <math.h>
+#include <random>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
 
 #include "ab-timed.h"
+#include "ab.h"
 #include "board_etc.h"
+#include "distributed.h"
+#include "engine.h"
+#include "matchbox_file.h"
+#include "matchbox_player.h"
+#include "move_ordering.h"
+#include "opening_book.h"
+#include "position_text.h"
+#include "reference.h"
 #include "state.h"
+#include "threat_search.h"
+#include "time_manager.h"
+#include "transposition_table.h"
 
 void test1() {
     auto b = Board({
@@ -36,6 +55,529 @@ void test2() {
            recursively_scheduled_tasks, recursively_evaluated_tasks, max_search_depth.load());
 }
 
+template<class R>
+void test_winning_values() {
+    using S = BasicState<R>;
+    std::minstd_rand rand(46);
+    int threats = 0;
+    int cards_played = 0;
+    for (int game=0; game < 200; ++game) {
+        S s = S::initial(std::ref(rand));
+        while (!s.is_tie_game()) {
+            for (Color who : { Red, Black }) {
+                auto wv = s.board().winning_values(who);
+                for (int v = 1; v <= R::max_value; ++v) {
+                    auto expected = s.board().must_respond_to_threat(Card(who, v));
+                    auto actual = wv.threat(v);
+                    assert(actual.is_forced == expected.is_forced && actual.is_double_threat == expected.is_double_threat);
+                    assert(!actual.is_forced || actual.move == expected.move);
+                    threats += actual.is_forced;
+                }
+            }
+            cards_played += 1;
+            if (s.apply_in_place(std::ref(rand), int(rand() % (s.count_columns() + 2)) - 1)) break;
+        }
+        assert(s.board().count_cards() <= R::max_cards);
+    }
+    printf("Winning values, to %d with cards 1-%d: %d threats in %d moves, all as must_respond_to_threat() finds them.\n",
+           R::target_sum, R::max_value, threats, cards_played);
+}
+
+// Checks the kernels of Board, State and the timed search against their
+// plain versions in reference.h, over every position of seeded playouts.
+void test_against_reference() {
+    std::mt19937 rand(50);
+    auto coroutine = make_engine("coroutine", hashed_eval);
+    int positions = 0;
+    int searches = 0;
+    for (int game=0; game < 100; ++game) {
+        State s = State::initial(std::ref(rand));
+        while (!s.is_tie_game()) {
+            const Board& b = s.board();
+            auto cols = reference::columns_of(b);
+            for (Color who : { Red, Black }) {
+                auto wv = b.winning_values(who);
+                for (int v=1; v <= GameRules::max_value; ++v) {
+                    Card card(who, v);
+                    for (int m = -1; m <= b.count_columns(); ++m) {
+                        auto next = cols;
+                        reference::play(next, m, card);
+                        assert(b.apply(m, card).is_win_involving(m, card) == reference::is_win_involving(next, m, card));
+                    }
+                    auto expected = reference::must_respond_to_threat(cols, card);
+                    for (ForcedMove fm : { b.must_respond_to_threat(card), wv.threat(v) }) {
+                        assert(fm.is_forced == expected.is_forced && fm.is_double_threat == expected.is_double_threat);
+                        assert(fm.move == expected.move);
+                    }
+                }
+            }
+            assert(s.toPacked(false) == reference::pack(s, false));
+            assert(s.toPacked(true) == reference::pack(s, true));
+            assert(s.toPackedCanonical() == reference::pack_canonical(s));
+            assert(reference::mirror_image(s).toPackedCanonical().first == s.toPackedCanonical().first);
+            positions += 1;
+
+            // The search proves forced wins first, however deep; the reference doesn't.
+            if (positions % 20 == 0 && !prove_forced_win(s).is_proven) {
+                int plies = (searches % 4 == 3) ? 3 : 2;
+                auto expected = reference::evaluate_to_depth(hashed_eval, s, plies);
+                SearchLimits limits;
+                limits.plies = plies;
+                SearchResult coro = coroutine->search(s, limits);
+                for (auto vm : { deterministically_evaluate(hashed_eval, s, plies, 0), std::make_pair(coro.value, coro.move) }) {
+                    assert(vm.first == expected.first);
+                    // Any best move will do, but facing two threats, or in the
+                    // opening, the value isn't the move's own.
+                    if (!s.must_respond_to_threat().is_double_threat && s.count_columns() >= 2) {
+                        assert(reference::value_of_move(hashed_eval, s, plies, vm.second) == expected.first);
+                    }
+                }
+                searches += 1;
+            }
+            if (s.apply_in_place(std::ref(rand), int(rand() % (s.count_columns() + 2)) - 1)) break;
+        }
+    }
+    printf("Against the reference: %d positions, %d searches, all agree.\n", positions, searches);
+}
+
+void test_deterministic_search() {
+    auto b = Board({
+        { Card("3r"), Card("6b"), Card("5r"), Card("4r"), Card("1b"), Card("2r") },
+        { Card("1r"), Card("4b"), Card("6r"), Card("3b"), Card("2b"), Card("6r"), Card("4b"), Card("3r"), Card("5b"), Card("4r"), Card("7b"), Card("6b"), Card("2r"), Card("5b") },
+    });
+    auto s = State(Red, Card("7r"), Card("4b"), std::move(b));
+
+    for (int plies = 1; plies <= 4; ++plies) {
+        SearchStats stats1;
+        SearchStats stats4;
+        set_search_threads(1);
+        auto vm1 = deterministically_evaluate(hashed_eval, s, plies, 0, &stats1);
+        set_search_threads(4);
+        auto vm4 = deterministically_evaluate(hashed_eval, s, plies, 0, &stats4);
+        printf("Depth %d: best move %d (value %g), %ld nodes.\n", plies, vm1.second, vm1.first, stats1.nodes);
+        assert(vm1 == vm4);
+        assert(stats1.nodes == stats4.nodes);
+        assert(stats1.depth == plies);
+    }
+    // Capping the live tasks makes the search go depth first, not differ.
+    SearchStats uncapped;
+    auto expected = deterministically_evaluate(hashed_eval, s, 4, 0, &uncapped);
+    set_max_live_nodes(100);
+    SearchStats capped;
+    auto actual = deterministically_evaluate(hashed_eval, s, 4, 0, &capped);
+    set_max_live_nodes(1L << 20);
+    printf("At most %ld live nodes, down from %ld.\n", capped.peak_live_nodes, uncapped.peak_live_nodes);
+    assert(actual == expected);
+    assert(capped.nodes == uncapped.nodes);
+    assert(capped.peak_live_nodes < uncapped.peak_live_nodes);
+
+    // A stop cuts short even a deterministic search, after its first ply.
+    // It says so, but not of the first ply, which a stop doesn't cut.
+    SearchStats one_ply;
+    bool finished = false;
+    auto expected_move = deterministically_evaluate(hashed_eval, s, 1, 0, &one_ply, &finished).second;
+    assert(finished);
+    std::atomic<bool> stop {true};
+    set_stop_flag(&stop);
+    SearchStats stopped;
+    auto stopped_move = deterministically_evaluate(hashed_eval, s, 4, 0, &stopped, &finished).second;
+    assert(!finished);
+    SearchStats stopped_one_ply;
+    deterministically_evaluate(hashed_eval, s, 1, 0, &stopped_one_ply, &finished);
+    assert(finished);
+    set_stop_flag(nullptr);
+    printf("Stopped: best move %d, %ld nodes.\n", stopped_move, stopped.nodes);
+    assert(stopped.nodes == one_ply.nodes);
+    assert(stopped_move == expected_move);
+
+    // A budget keeps the deepest iteration that fits in it, whatever the threads.
+    for (long budget : { 1000, 100000 }) {
+        SearchStats stats1;
+        SearchStats stats4;
+        set_search_threads(1);
+        finished = true;
+        auto vm1 = deterministically_evaluate(hashed_eval, s, 0, budget, &stats1, &finished);
+        assert(!finished);  // the budget is the limit here
+        set_search_threads(4);
+        auto vm4 = deterministically_evaluate(hashed_eval, s, 0, budget, &stats4);
+        printf("Budget of %ld nodes: best move %d (value %g), depth %d, %ld nodes.\n",
+               budget, vm1.second, vm1.first, stats1.depth, stats1.nodes);
+        assert(vm1 == vm4);
+        assert(stats1.nodes == stats4.nodes && stats1.depth == stats4.depth);
+        assert(stats1.nodes <= budget);
+        assert(vm1 == deterministically_evaluate(hashed_eval, s, stats1.depth, 0));
+    }
+}
+
+void test_out_of_time() {
+    // Red has to block at 1, and has to see that even with no time left.
+    std::string error;
+    auto s = parse_position("1r / 6b 5b / 2r ; 3r 4b ; r", &error);
+    assert(s != nullptr && s->must_respond_to_threat().move == 1);
+    bool finished = false;
+    auto vm = evaluate_to_depth(hashed_eval, *s, 1, std::chrono::steady_clock::now(), &finished);
+    assert(vm.second == 1 && finished);
+    vm = evaluate_to_depth(hashed_eval, *s, 0, std::chrono::steady_clock::now(), &finished);
+    assert(vm.second == 1);
+    TimeManager tm(std::chrono::milliseconds(0));
+    vm = tm.evaluate(hashed_eval, *s);
+    printf("Out of time: move %d (value %g).\n", vm.second, vm.first);
+    assert(vm.second == 1);
+}
+
+void test_move_priors() {
+    // A position that isn't settled before the search looks at its moves,
+    // as one may be in a variant.
+    std::minstd_rand rand(41);
+    State s = State::initial(std::ref(rand));
+    SearchStats without;
+    std::pair<double, int> expected;
+    while (true) {
+        for (int i=0; i < 8; ++i) {
+            s.apply_in_place(std::ref(rand), int(rand() % (s.count_columns() + 2)) - 1);
+        }
+        expected = deterministically_evaluate(hashed_eval, s, 3, 0, &without);
+        if (without.nodes > 1) break;
+        s = State::initial(std::ref(rand));
+        without = SearchStats();
+    }
+
+    // Priors only change the order of the search, never its result.
+    std::atomic<int> calls {0};
+    set_move_priors([&calls](const State& t, double *priors) {
+        calls += 1;
+        for (int m = -1; m <= t.count_columns(); ++m) {
+            priors[m+1] = m + 2;  // rightmost first
+        }
+        return true;
+    }, 2);
+    SearchStats with;
+    auto actual = deterministically_evaluate(hashed_eval, s, 3, 0, &with);
+    set_move_priors(nullptr);
+    printf("With priors: best move %d (value %g), %ld nodes, %d lookups.\n",
+           actual.second, actual.first, with.nodes, calls.load());
+    assert(actual == expected);
+    assert(with.nodes == without.nodes);
+    assert(calls > 0);
+}
+
+void test_leftmost_win() {
+    // Priors don't pick among immediate wins either: the leftmost is played.
+    auto b = Board({ { Card("7r"), Card("6r") }, { Card("1b") }, { Card("7r"), Card("6r") }, { Card("2b") } });
+    State wins(Red, Card("2r"), Card("3b"), std::move(b));
+    set_move_priors([](const State& t, double *priors) {
+        for (int m = -1; m <= t.count_columns(); ++m) {
+            priors[m+1] = m + 2;
+        }
+        return true;
+    }, 2);
+    bool finished = false;
+    auto win = evaluate_to_depth(hashed_eval, wins, 1, std::chrono::steady_clock::time_point::max(), &finished);
+    set_move_priors(nullptr);
+    assert(win.first == double(INT_MAX) && win.second == 0);
+
+    // Nor does the sequential search's history of this thread's searches.
+    for (int depth = 1; depth <= 3; ++depth) {
+        thread_move_ordering().record_good_move(wins, depth, 2, 1 << 16);
+    }
+    win = sequentially_evaluate(hashed_eval, wins, 1, 0, std::chrono::steady_clock::time_point::max());
+    assert(win.first == double(INT_MAX) && win.second == 0);
+}
+
+void test_engines() {
+    SearchLimits limits;
+    assert(parse_search_limits("150", &limits) && limits.time.count() == 150);
+    assert(parse_search_limits("4plies+20000nodes", &limits) && limits.plies == 4 && limits.nodes == 20000);
+    assert(!parse_search_limits("4parsecs", &limits));
+    assert(!parse_search_limits("", &limits));
+    assert(make_engine("no such engine") == nullptr);
+    auto mcts = make_engine("mcts");
+    assert(parse_search_limits("2plies", &limits) && !mcts->supports(limits) && make_engine("timed")->supports(limits));
+    assert(parse_search_limits("100ms", &limits) && mcts->supports(limits));
+    assert(parse_search_limits("20000nodes+150ms", &limits) && !make_engine("timed")->supports(limits));
+    assert(make_engine("sequential")->supports(limits));
+
+    std::string error;
+    auto s = parse_position("3r / 1r 4b ; 5r 2b ; b", &error);
+    auto sequential = make_engine("sequential", hashed_eval);
+    assert(sequential != nullptr);
+    limits = SearchLimits();
+    limits.nodes = 5000;
+    SearchResult r = sequential->search(*s, limits);
+    printf("Sequential, 5000 nodes: best move %d (value %g), depth %d, %ld nodes.\n",
+           r.move, r.value, r.stats.depth, r.stats.nodes);
+    assert(r.stats.depth >= 1 && r.stats.nodes <= 5001);
+    limits = SearchLimits();
+    limits.plies = r.stats.depth;
+    SearchResult fixed = sequential->search(*s, limits);
+    assert(fixed.move == r.move && fixed.value == r.value);
+
+    TranspositionTable tt(10);
+    TranspositionTable::Entry e;
+    assert(!tt.probe(12345, &e));
+    tt.store(12345, TranspositionTable::Entry{ INT_MAX, -1, 3 });
+    tt.store(12345, TranspositionTable::Entry{ 0.25, 2, 2 });  // shallower; ignored
+    assert(tt.probe(12345, &e) && e.value == INT_MAX && e.move == -1 && e.depth == 3);
+    assert(!tt.probe(12345 + 1024, &e));
+
+    set_search_threads(2);
+    limits = SearchLimits();
+    limits.plies = 3;
+    SearchResult lazy = make_engine("lazysmp", hashed_eval)->search(*s, limits);
+    printf("Lazy SMP, 2 threads, depth 3: best move %d (value %g), %ld nodes.\n", lazy.move, lazy.value, lazy.stats.nodes);
+    assert(lazy.stats.depth == 3 && -1 <= lazy.move && lazy.move <= s->count_columns());
+
+    // On one thread, it's the sequential search, but that the table keeps
+    // values as floats.
+    set_search_threads(1);
+    std::minstd_rand rand(43);
+    for (int i=0; i < 4; ++i) {
+        State t = State::initial(std::ref(rand));
+        for (int j=0; j < 6 && !t.is_tie_game(); ++j) {
+            t.apply_in_place(std::ref(rand), int(rand() % (t.count_columns() + 2)) - 1);
+        }
+        SearchResult expected = make_engine("sequential", hashed_eval)->search(t, limits);
+        SearchResult actual = make_engine("lazysmp", hashed_eval)->search(t, limits);
+        printf("Lazy SMP, 1 thread, depth 3: best move %d (value %.9g), expected %d (value %.9g).\n",
+               actual.move, actual.value, expected.move, expected.value);
+        assert(fabs(actual.value - expected.value) <= 1e-6 * std::max(1.0, fabs(expected.value)));
+        // Where the value is proven, several moves may win, or all lose.
+        bool is_proven = (fabs(expected.value) >= double(INT_MAX - 1));
+        assert(actual.move == expected.move || is_proven);
+    }
+    set_search_threads(4);
+
+    // The same search, as callbacks and as coroutines, visits the same tree.
+    SearchResult timed = make_engine("timed", hashed_eval)->search(*s, limits);
+    SearchResult coro = make_engine("coroutine", hashed_eval)->search(*s, limits);
+    printf("Coroutines, depth 3: best move %d (value %g), %ld nodes.\n", coro.move, coro.value, coro.stats.nodes);
+    assert(coro.move == timed.move && coro.value == timed.value && coro.stats.nodes == timed.stats.nodes);
+
+    // It stops as the timed search does, after the first ply...
+    auto coroutine = make_engine("coroutine", hashed_eval);
+    limits.plies = 1;
+    SearchResult one_ply = coroutine->search(*s, limits);
+    limits.plies = 3;
+    std::atomic<bool> stop {true};
+    set_stop_flag(&stop);
+    SearchResult stopped = coroutine->search(*s, limits);
+    set_stop_flag(nullptr);
+    assert(stopped.stats.nodes == one_ply.stats.nodes);
+
+    // ...but has no node budget, and ignores move priors and the live cap.
+    std::atomic<int> calls {0};
+    set_move_priors([&calls](const State&, double *) { calls += 1; return false; });
+    set_max_live_nodes(100);
+    SearchResult unchanged = coroutine->search(*s, limits);
+    set_max_live_nodes(1L << 20);
+    set_move_priors(nullptr);
+    assert(calls == 0 && unchanged.stats.nodes == coro.stats.nodes && unchanged.stats.peak_live_nodes == 0);
+    assert(parse_search_limits("20000nodes", &limits) && !coroutine->supports(limits));
+}
+
+void test_matchbox_eviction() {
+    MatchboxPlayer mp;
+    std::minstd_rand rand(44);
+    State protected_position = State::initial(3, 5);
+    protected_position.apply_in_place_without_drawing(-1);
+    protected_position.draw_this_card(Red, 2);
+    mp.record_definitely_best_move(protected_position, 1);
+    for (int game=0; game < 40; ++game) {
+        State s = State::initial(std::ref(rand));
+        for (int i=0; i < 10 && !s.is_tie_game(); ++i) {
+            auto pm = mp.pick_move(std::ref(rand), s);
+            if (s.apply_in_place(std::ref(rand), pm.move)) break;
+        }
+        (game % 2) ? mp.record_win_and_reset() : mp.record_loss_and_reset();
+        if (game == 19) {
+            mp.set_memory_cap(mp.stats().bytes / 2);
+        }
+    }
+    auto st = mp.stats();
+    printf("Matchboxes: %zu of %zu, evicted %ld untouched and %ld trained in %ld passes.\n",
+           st.entries, st.capacity, st.evicted_untouched, st.evicted_trained, st.evictions);
+    assert(st.entries <= st.capacity && st.evictions > 0);
+    double priors[30];
+    assert(mp.move_priors(protected_position, priors) && priors[2] == 1);
+}
+
+void test_matchbox_journal() {
+    std::string filename = "/tmp/connect15-test-" + std::to_string(getpid()) + ".matchboxes";
+    std::string journal = filename + ".journal";
+    auto play_a_game = [](MatchboxPlayer& mp, std::minstd_rand& rand) {
+        State s = State::initial(std::ref(rand));
+        for (int i=0; i < 6 && !s.is_tie_game(); ++i) {
+            auto pm = mp.pick_move(std::ref(rand), s);
+            if (s.apply_in_place(std::ref(rand), pm.move)) break;
+        }
+        mp.record_win_and_reset();
+    };
+    std::minstd_rand rand(45);
+    MatchboxPlayer mp;
+    play_a_game(mp, rand);
+    mp.checkpoint_to_file(filename.c_str());
+
+    // A checkpoint that crashed partway through a record leaves a torn tail;
+    // loading cuts it off, so that the next checkpoint lines up again.
+    FILE *fp = fopen(journal.c_str(), "a");
+    fwrite("torn", 1, 4, fp);
+    fclose(fp);
+    MatchboxPlayer reloaded;
+    reloaded.load_from_file(filename.c_str());
+    assert(reloaded.stats().entries == mp.stats().entries);
+    play_a_game(reloaded, rand);
+    reloaded.checkpoint_to_file(filename.c_str());
+    MatchboxPlayer again;
+    again.load_from_file(filename.c_str());
+    printf("Matchbox journal: %zu entries, then %zu after a torn tail.\n",
+           mp.stats().entries, again.stats().entries);
+    assert(again.stats().entries == reloaded.stats().entries);
+
+    // What eviction goes by survives the reloads, game count and all.
+    again.save_to_file(filename.c_str());
+    MatchboxFileReader reader(filename);
+    PackedState key;
+    MatchboxPlayer::Choices choices;
+    MatchboxPlayer::Aging aging;
+    size_t records = 0;
+    bool seen_in_second_game = false;
+    while (reader.next(key, choices, &aging)) {
+        assert(aging.visits_ >= 1 && aging.last_seen_ <= 1);
+        seen_in_second_game |= (aging.last_seen_ == 1);
+        records += 1;
+    }
+    assert(reader.checksum_ok() && records == again.stats().entries && seen_in_second_game);
+    unlink(journal.c_str());
+    unlink(filename.c_str());
+}
+
+void test_position_text() {
+    std::minstd_rand rand(7);
+    State s = State::initial(std::ref(rand));
+    for (int i=0; i < 12; ++i) {
+        s.apply_in_place(std::ref(rand), int(rand() % (s.count_columns() + 2)) - 1);
+    }
+    std::string text = format_position(s);
+    printf("%s\n", text.c_str());
+
+    std::string error;
+    auto t = parse_position(text, &error);
+    assert(t != nullptr);
+    assert(format_position(*t) == text);
+    assert(t->toPacked() == s.toPacked());
+    for (int v=1; v <= GameRules::max_value; ++v) {
+        assert(t->count_unseen_cards(Red, v) == s.count_unseen_cards(Red, v));
+        assert(t->count_unseen_cards(Black, v) == s.count_unseen_cards(Black, v));
+    }
+
+    assert(parse_position("3r/4b ; .. 2b ; b", &error) != nullptr);
+    std::string too_many;
+    for (int i=0; i <= GameRules::copies; ++i) {
+        too_many += "3r ";
+    }
+    assert(parse_position(too_many + "; .. .. ; r", &error) == nullptr);
+    assert(parse_position("3r ; 4b .. ; r", &error) == nullptr);
+    assert(parse_position("3r // 4b ; .. .. ; r", &error) == nullptr);
+    assert(parse_position("3r ; .. .. ; x", &error) == nullptr);
+}
+
+void test_distributed_search() {
+    std::string address = "unix:/tmp/connect15-test-" + std::to_string(getpid()) + ".sock";
+    int fd = listen_on(address);
+    assert(fd >= 0);
+    std::thread([fd]() { serve_search_requests(fd); }).detach();
+
+    // Two connections to the same worker split the root moves between them.
+    DistributedSearch ds({ address, address });
+    std::minstd_rand rand(15);
+    for (int i=0; i < 4; ++i) {
+        State s = State::initial(std::ref(rand));
+        for (int j=0; j < 6 && !s.is_tie_game(); ++j) {
+            s.apply_in_place(std::ref(rand), s.count_columns());
+        }
+        auto expected = deterministically_evaluate(hashed_eval, s, 3, 0);
+        auto actual = ds.evaluate(hashed_eval, s, std::chrono::milliseconds(0), 3);
+        printf("Distributed: best move %d (value %g), expected %d (value %g).\n",
+               actual.second, actual.first, expected.second, expected.first);
+        assert(actual.first == expected.first);
+        assert(actual.second == expected.second);
+    }
+
+    // A worker that never answers has its moves searched locally.
+    std::string hung_address = "unix:/tmp/connect15-test-" + std::to_string(getpid()) + "-hung.sock";
+    int hung_fd = listen_on(hung_address);
+    assert(hung_fd >= 0);
+    DistributedSearch with_hung({ address, hung_address }, std::chrono::milliseconds(200));
+    State s = State::initial(std::ref(rand));
+    for (int j=0; j < 6 && !s.is_tie_game(); ++j) {
+        s.apply_in_place(std::ref(rand), s.count_columns());
+    }
+    auto expected = deterministically_evaluate(hashed_eval, s, 3, 0);
+    auto actual = with_hung.evaluate(hashed_eval, s, std::chrono::milliseconds(0), 3);
+    assert(actual.first == expected.first);
+    assert(actual.second == expected.second);
+
+    // A worker's share is cancelled once its coordinator gives up on it,
+    // after the first ply, which is always searched.
+    std::atomic<bool> cancel {true};
+    SearchStats cancelled;
+    evaluate_root_moves(hashed_eval, s, { 0, 1 }, 20, std::chrono::steady_clock::time_point::max(), &cancelled, &cancel);
+    printf("Distributed: a cancelled search reached depth %d.\n", cancelled.depth);
+    assert(cancelled.depth <= 1);
+    close(hung_fd);
+    unlink(hung_address.c_str() + 5);
+    unlink(address.c_str() + 5);
+}
+
+void test_opening_book() {
+    std::string error;
+    auto s = parse_position("3r / 1r 4b ; 5r 2b ; b", &error);
+    auto mirrored = parse_position("1r 4b / 3r ; 5r 2b ; b", &error);
+    auto other = parse_position("3r / 1r 4b ; 5r 3b ; b", &error);
+    assert(s != nullptr && mirrored != nullptr && other != nullptr);
+    assert(s->toPackedCanonical().first == mirrored->toPackedCanonical().first);
+
+    std::string filename = "/tmp/connect15-test-" + std::to_string(getpid()) + ".book";
+    OpeningBookWriter writer(filename);
+    auto key = s->toPackedCanonical();
+    writer.write(key.first, 0.5, key.second ? s->mirror_move(2) : 2);
+    writer.finish();
+
+    OpeningBook book;
+    assert(book.open(filename));
+    assert(book.size() == 1);
+    std::pair<double, int> vm;
+    assert(book.lookup(*s, &vm) && vm.first == 0.5 && vm.second == 2);
+    assert(book.lookup(*mirrored, &vm) && vm.second == mirrored->mirror_move(2));
+    assert(!book.lookup(*other, &vm));
+
+    // A proven win reads back as exactly INT_MAX, as the searches return it.
+    OpeningBookWriter proven(filename);
+    key = other->toPackedCanonical();
+    proven.write(key.first, INT_MAX, 1);
+    proven.finish();
+    OpeningBook proven_book;
+    assert(proven_book.open(filename));
+    assert(proven_book.lookup(*other, &vm) && vm.first == double(INT_MAX));
+    unlink(filename.c_str());
+}
+
 int main() {
-    test2();
+    test_winning_values<GameRules>();
+    test_winning_values<Rules<10, 5, 2>>();
+    test_against_reference();
+    test_move_priors();
+    test_position_text();
+    test_opening_book();
+    test_engines();
+    test_matchbox_eviction();
+    test_matchbox_journal();
+    test_distributed_search();
+    // These use positions with cards that a smaller variant (see rules.h) may not have.
+    if (std::is_same<GameRules, StandardRules>::value) {
+        test2();
+        test_deterministic_search();
+        test_out_of_time();
+        test_leftmost_win();
+    }
 }
@@ -0,0 +1,229 @@
+#include "ab-timed.h"
+#include "engine.h"
+#include "opening_book.h"
+#include "state.h"
+#include "time_manager.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <math.h>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Usage: ./tournament engineA engineB [games] [seed] [concurrent-games]
+//
+// Plays up to N games between two engines, quietly, with several games in
+// flight at once. Each player is "<engine>:<limits>", for any engine in
+// engine.h with limits as parse_search_limits takes them (e.g. "timed:150",
+// the timed search with 150 ms a move, or "sequential:3plies"), or else
+// "managed:<ms>" (the timed search with that budget per game, spent by a
+// TimeManager), or "random". A plays Red in the even-numbered games. If
+// there's an "opening.book" in the current directory, the timed and Monte
+// Carlo searches play from it.
+// Game i draws its cards from an mt19937 seeded by the i-th output of an
+// mt19937 seeded with `seed`, so the same seed replays the same deals.
+//
+// After every game, a sequential probability ratio test compares the
+// hypotheses "A is no stronger than B" (elo0) and "A is stronger by elo1";
+// the tournament stops as soon as either is accepted.
+
+struct Player {
+    std::string spec_;
+    std::unique_ptr<Engine> engine_;
+    SearchLimits limits_;
+    int millis_ = 0;
+    bool is_managed_ = false;
+    mutable std::atomic<long> thinking_us_ {0};
+
+    explicit Player(const std::string& spec) : spec_(spec) {
+        size_t colon = spec.find(':');
+        std::string name = spec.substr(0, colon);
+        std::string limits = (colon == std::string::npos) ? "" : spec.substr(colon + 1);
+        if (name == "managed") {
+            millis_ = atoi(limits.c_str());
+            is_managed_ = true;
+        } else if (name != "random") {
+            engine_ = make_engine(name);
+            if (engine_ == nullptr || !parse_search_limits(limits, &limits_)) {
+                fprintf(stderr, "Unknown engine \"%s\"; expected <engine>:<limits>, managed:<ms> or random. The engines are:\n", spec.c_str());
+                print_engines(stderr);
+                exit(1);
+            }
+            if (!engine_->supports(limits_)) {
+                fprintf(stderr, "Engine \"%s\" can't search within \"%s\". The engines are:\n", name.c_str(), limits.c_str());
+                print_engines(stderr);
+                exit(1);
+            }
+        }
+        assert(!is_managed_ || millis_ > 0);
+    }
+
+    int pick_move(std::mt19937& rand, TimeManager& clock, const State& s) const {
+        auto start = std::chrono::steady_clock::now();
+        int move;
+        if (is_managed_) {
+            move = clock.evaluate(simplest_eval, s).second;
+        } else if (engine_ != nullptr) {
+            move = engine_->search(s, limits_).move;
+        } else {
+            move = int(rand() % (s.count_columns() + 2)) - 1;
+        }
+        thinking_us_ += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        return move;
+    }
+};
+
+// Returns the winner, or Nobody for a tie.
+static Color play_one_game(const Player& red, const Player& black, uint32_t seed)
+{
+    std::mt19937 card_rand(seed);
+    std::mt19937 move_rand(seed ^ 0x9E3779B9u);
+    State s = State::initial(std::ref(card_rand));
+    TimeManager clocks[2] = {
+        TimeManager(std::chrono::milliseconds(red.millis_)),
+        TimeManager(std::chrono::milliseconds(black.millis_)),
+    };
+    for (Color who = Red; true; who = Color(1 - who)) {
+        const Player& p = (who == Red) ? red : black;
+        int move = p.pick_move(move_rand, clocks[who], s);
+        if (s.apply_in_place(std::ref(card_rand), move)) {
+            return who;
+        } else if (s.is_tie_game()) {
+            return Nobody;
+        }
+    }
+}
+
+struct Tally {
+    int wins = 0;
+    int losses = 0;
+    int ties = 0;
+
+    int games() const { return wins + losses + ties; }
+    double score() const { return (wins + 0.5 * ties) / games(); }
+    double variance() const {
+        double s = score();
+        return (wins * (1-s) * (1-s) + ties * (0.5-s) * (0.5-s) + losses * s * s) / games();
+    }
+
+    // The generalized SPRT's log-likelihood ratio, in the usual normal approximation.
+    // The variance gets half a pseudo-game of each outcome, so that a clean sweep
+    // (with a sample variance of zero) can still end the test.
+    double llr(double elo0, double elo1) const {
+        auto expected_score = [](double elo) { return 1 / (1 + pow(10, -elo / 400)); };
+        double s0 = expected_score(elo0);
+        double s1 = expected_score(elo1);
+        double w = wins + 0.5;
+        double l = losses + 0.5;
+        double d = ties + 0.5;
+        double s = (w + d/2) / (w + l + d);
+        double var = (w * (1-s) * (1-s) + d * (0.5-s) * (0.5-s) + l * s * s) / (w + l + d);
+        return games() * (s1 - s0) * (2*score() - s0 - s1) / (2 * var);
+    }
+};
+
+static double elo_from_score(double s)
+{
+    s = std::min(std::max(s, 1e-6), 1 - 1e-6);
+    return -400 * log10(1/s - 1);
+}
+
+static void print_tally(const char *prefix, const Tally& t, double llr, double lower, double upper)
+{
+    double s = t.score();
+    double margin = 1.96 * sqrt(t.variance() / t.games());
+    printf("%s%d games: +%d -%d =%d  score %.3f +/- %.3f  elo %+.1f [%+.1f, %+.1f]  LLR %.2f [%.2f, %.2f]\n",
+           prefix, t.games(), t.wins, t.losses, t.ties, s, margin,
+           elo_from_score(s), elo_from_score(s - margin), elo_from_score(s + margin),
+           llr, lower, upper);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s engineA engineB [games] [seed] [concurrent-games]\n", argv[0]);
+        return 1;
+    }
+    Player a(argv[1]);
+    Player b(argv[2]);
+    const int max_games = (argc > 3) ? atoi(argv[3]) : 1000;
+    const uint32_t seed = (argc > 4) ? atoi(argv[4]) : 1;
+    const int concurrency = (argc > 5) ? atoi(argv[5]) : std::max(1u, std::thread::hardware_concurrency());
+
+    const double elo0 = 0;
+    const double elo1 = 20;
+    const double alpha = 0.05;
+    const double beta = 0.05;
+    const double lower = log(beta / (1 - alpha));
+    const double upper = log((1 - beta) / alpha);
+
+    set_search_threads(std::max(1u, std::thread::hardware_concurrency()));
+    if (load_opening_book("opening.book")) {
+        printf("Using opening.book\n");
+    }
+
+    std::vector<uint32_t> seeds(max_games);
+    std::mt19937 seeder(seed);
+    for (auto& s : seeds) {
+        s = seeder();
+    }
+
+    std::atomic<int> next_game {0};
+    std::atomic<bool> stop {false};
+    std::mutex mtx;
+    Tally tally;
+    double llr = 0;
+
+    auto worker = [&]() {
+        while (!stop) {
+            int i = next_game++;
+            if (i >= max_games) break;
+            bool a_is_red = (i % 2 == 0);
+            Color winner = a_is_red ? play_one_game(a, b, seeds[i]) : play_one_game(b, a, seeds[i]);
+            Color a_color = a_is_red ? Red : Black;
+
+            std::lock_guard<std::mutex> lk(mtx);
+            if (winner == Nobody) {
+                tally.ties += 1;
+            } else if (winner == a_color) {
+                tally.wins += 1;
+            } else {
+                tally.losses += 1;
+            }
+            llr = tally.llr(elo0, elo1);
+            if (llr <= lower || llr >= upper) {
+                stop = true;
+            }
+            if (tally.games() % 50 == 0) {
+                print_tally("", tally, llr, lower, upper);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i=0; i < concurrency; ++i) {
+        threads.emplace_back(worker);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    printf("%s vs %s, seed %u\n", a.spec_.c_str(), b.spec_.c_str(), seed);
+    print_tally("Final: ", tally, llr, lower, upper);
+    for (const Player *p : { &a, &b }) {
+        printf("%s thought for %.0f ms per game.\n", p->spec_.c_str(), p->thinking_us_ / 1000.0 / tally.games());
+    }
+    if (llr >= upper) {
+        printf("SPRT: H1 accepted; %s is stronger by about %g elo.\n", a.spec_.c_str(), elo1);
+    } else if (llr <= lower) {
+        printf("SPRT: H0 accepted; %s is not stronger.\n", a.spec_.c_str());
+    } else {
+        printf("SPRT: inconclusive after %d games.\n", tally.games());
+    }
+}
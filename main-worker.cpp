@@ -0,0 +1,28 @@
+#include "ab-timed.h"
+#include "distributed.h"
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+
+// Usage: ./worker unix:<path> | tcp:<host>:<port> [threads]
+//
+// Serves root-split searches for a coordinator (see distributed.h), such
+// as `./analyze --workers ...`, until killed.
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s unix:<path> | tcp:<host>:<port> [threads]\n", argv[0]);
+        return 1;
+    }
+    int threads = (argc > 2) ? atoi(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+    set_search_threads(threads);
+    int fd = listen_on(argv[1]);
+    if (fd < 0) {
+        return 1;
+    }
+    printf("Listening on %s with %d search threads.\n", argv[1], threads);
+    fflush(stdout);
+    serve_search_requests(fd);
+}
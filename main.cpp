@@ -1,6 +1,8 @@
 
 #include "ab-timed.h"
+#include "opening_book.h"
 #include "state.h"
+#include "time_manager.h"
 #include <iostream>
 #include <stdlib.h>
 #include <time.h>
@@ -13,16 +15,21 @@ int wins[3] = { 0, 0, 0 };
 int main()
 {
     srand(time(nullptr));
+    load_opening_book("opening.book");  // if it's there; see main-book.cpp
 
 #if LOOP_FOREVER
     while (true) {
 #endif
 
     State s = State::initial(rand);
+    TimeManager clocks[2] = {
+        TimeManager(std::chrono::milliseconds(1200)),
+        TimeManager(std::chrono::milliseconds(1200)),
+    };
 
     for (Color who = Red; true; who = Color(1 - who)) {
         std::string swho = ((who == Red) ? "Red" : "Black");
-        auto vm = recursively_evaluate(simplest_eval, s, std::chrono::milliseconds(150));
+        auto vm = clocks[who].evaluate(simplest_eval, s);
         std::cout << s.toString() << "\n";
         std::cout << "AI thinks " << swho << "'s best move is " << vm.second << " (value " << vm.first << ").\n";
         printf("Scheduled %d tasks, ran %d tasks, search depth %d.\n",
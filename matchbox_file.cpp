@@ -0,0 +1,222 @@
+#include "matchbox_file.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char magic[4] = { 'C', '1', '5', 'M' };
+static const char journal_magic[4] = { 'C', '1', '5', 'J' };
+static const int current_version = 2;
+
+using Choices = MatchboxPlayer::Choices;
+using Aging = MatchboxPlayer::Aging;
+
+static uint32_t fnv1a(uint32_t h, const uint8_t *p, size_t n)
+{
+    for (size_t i=0; i < n; ++i) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+static void put_le(uint8_t *p, uint64_t x, int n)
+{
+    for (int i=0; i < n; ++i) {
+        p[i] = (x >> (8*i));
+    }
+}
+
+static uint64_t get_le(const uint8_t *p, int n)
+{
+    uint64_t x = 0;
+    for (int i=n-1; i >= 0; --i) {
+        x = (x << 8) | p[i];
+    }
+    return x;
+}
+
+static bool read_legacy_record(FILE *fp, PackedState& key, Choices& choices)
+{
+    // A short read means end-of-file, or a journal record torn by a crash
+    // in the middle of a checkpoint; either way, there is nothing more to read.
+    size_t nbytes = fread(key.data_, 1, PackedState::size, fp);
+    if (nbytes != PackedState::size) {
+        return false;
+    }
+    uint8_t num_matchboxes = 0;
+    nbytes = fread(&num_matchboxes, 1, 1, fp);
+    if (nbytes != 1) {
+        return false;
+    }
+    assert(1 <= num_matchboxes && num_matchboxes <= MatchboxPlayer::Choices::max_matchboxes);
+    memset(choices.weights_, '\0', MatchboxPlayer::Choices::max_matchboxes);
+    nbytes = fread(choices.weights_, 1, num_matchboxes, fp);
+    return (nbytes == num_matchboxes);
+}
+
+// A record of the given version, and its contribution to the checksum.
+static bool read_record(FILE *fp, int version, PackedState& key, Choices& choices, Aging *aging)
+{
+    *aging = Aging();
+    if (!read_legacy_record(fp, key, choices)) {
+        return false;
+    }
+    if (version >= 2) {
+        uint8_t buf[8];
+        if (fread(buf, 1, 8, fp) != 8) {
+            return false;
+        }
+        aging->visits_ = get_le(buf, 4);
+        aging->last_seen_ = get_le(buf + 4, 4);
+    }
+    return true;
+}
+
+static uint32_t checksum_record(uint32_t h, int version, const PackedState& key, const Choices& choices, const Aging& aging)
+{
+    uint8_t n = choices.num_matchboxes();
+    h = fnv1a(h, key.data_, PackedState::size);
+    h = fnv1a(h, &n, 1);
+    h = fnv1a(h, choices.weights_, n);
+    if (version >= 2) {
+        uint8_t buf[8];
+        put_le(buf, aging.visits_, 4);
+        put_le(buf + 4, aging.last_seen_, 4);
+        h = fnv1a(h, buf, 8);
+    }
+    return h;
+}
+
+static void write_record(FILE *fp, const PackedState& key, const Choices& choices, const Aging& aging)
+{
+    fwrite(key.data_, 1, PackedState::size, fp);
+    uint8_t num_matchboxes = choices.num_matchboxes();
+    fwrite(&num_matchboxes, 1, 1, fp);
+    fwrite(choices.weights_, 1, num_matchboxes, fp);
+    uint8_t buf[8];
+    put_le(buf, aging.visits_, 4);
+    put_le(buf + 4, aging.last_seen_, 4);
+    fwrite(buf, 1, 8, fp);
+}
+
+void write_journal_header(FILE *fp)
+{
+    uint8_t header[16] = {};
+    memcpy(header, journal_magic, 4);
+    put_le(header + 4, current_version, 4);
+    fwrite(header, 1, 16, fp);
+}
+
+void write_journal_record(FILE *fp, const PackedState& key, const Choices& choices, const Aging& aging)
+{
+    write_record(fp, key, choices, aging);
+}
+
+MatchboxFileReader::MatchboxFileReader(const std::string& filename)
+{
+    fp_ = fopen(filename.c_str(), "r");
+    if (fp_ == nullptr) {
+        return;
+    }
+    uint8_t header[16];
+    size_t nbytes = fread(header, 1, 16, fp_);
+    if (nbytes == 16 && memcmp(header, magic, 4) == 0) {
+        version_ = get_le(header + 4, 4);
+        remaining_ = get_le(header + 8, 8);
+        assert(1 <= version_ && version_ <= current_version);
+    } else if (nbytes == 16 && memcmp(header, journal_magic, 4) == 0) {
+        version_ = get_le(header + 4, 4);
+        is_journal_ = true;
+        good_size_ = 16;
+        assert(version_ == current_version);
+    } else {
+        rewind(fp_);
+    }
+}
+
+MatchboxFileReader::~MatchboxFileReader()
+{
+    if (fp_ != nullptr) {
+        fclose(fp_);
+    }
+}
+
+bool MatchboxFileReader::next(PackedState& key, Choices& choices, Aging *aging)
+{
+    if (fp_ == nullptr) {
+        return false;
+    }
+    Aging unused;
+    if (aging == nullptr) {
+        aging = &unused;
+    }
+    if (version_ == 0 || is_journal_) {
+        if (!read_record(fp_, version_, key, choices, aging)) {
+            is_torn_ = (ftell(fp_) != good_size_);
+            return false;
+        }
+        good_size_ = ftell(fp_);
+        return true;
+    }
+    if (remaining_ == 0) {
+        uint8_t trailer[4];
+        checksum_ok_ = (fread(trailer, 1, 4, fp_) == 4) && (get_le(trailer, 4) == checksum_);
+        return false;
+    }
+    if (!read_record(fp_, version_, key, choices, aging)) {
+        checksum_ok_ = false;
+        return false;
+    }
+    checksum_ = checksum_record(checksum_, version_, key, choices, *aging);
+    remaining_ -= 1;
+    return true;
+}
+
+MatchboxFileWriter::MatchboxFileWriter(const std::string& filename, const char *tmp_suffix) :
+    filename_(filename), tmpname_(filename + tmp_suffix)
+{
+    fp_ = fopen(tmpname_.c_str(), "w");
+    assert(fp_ != nullptr);
+    uint8_t header[16] = {};
+    fwrite(header, 1, 16, fp_);  // filled in by finish()
+}
+
+MatchboxFileWriter::~MatchboxFileWriter()
+{
+    if (fp_ != nullptr) {
+        // finish() was never called; don't clobber the real file.
+        fclose(fp_);
+        remove(tmpname_.c_str());
+    }
+}
+
+void MatchboxFileWriter::write(const PackedState& key, const Choices& choices, const Aging& aging)
+{
+    assert(count_ == 0 || last_key_ < key);
+    last_key_ = key;
+    write_record(fp_, key, choices, aging);
+    checksum_ = checksum_record(checksum_, current_version, key, choices, aging);
+    count_ += 1;
+}
+
+void MatchboxFileWriter::finish()
+{
+    uint8_t trailer[4];
+    put_le(trailer, checksum_, 4);
+    fwrite(trailer, 1, 4, fp_);
+
+    uint8_t header[16];
+    memcpy(header, magic, 4);
+    put_le(header + 4, current_version, 4);
+    put_le(header + 8, count_, 8);
+    fseek(fp_, 0, SEEK_SET);
+    fwrite(header, 1, 16, fp_);
+
+    fflush(fp_);
+    fsync(fileno(fp_));
+    fclose(fp_);
+    fp_ = nullptr;
+    rename(tmpname_.c_str(), filename_.c_str());
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#include "matchbox_player.h"
+#include "packed_state.h"
+
+// Version 2 of the matchbox database format:
+//
+//     "C15M"  uint32 version  uint64 record_count     (little-endian)
+//     record_count records, sorted by strictly increasing key:
+//         32-byte PackedState, uint8 n, n weights, uint32 visits, uint32 last_seen
+//     uint32 FNV-1a checksum of all the record bytes
+//
+// Version 1 has no visits or last_seen, which read as 0. The journal is
+// "C15J", the version and a zero count, then the same records, appended
+// unsorted, with no trailer.
+//
+// The original format is version 1's records, unsorted, with no header
+// or trailer; older journals use it too, and MatchboxFileReader reads all
+// of these. A legacy file can't start with "C15M" or "C15J", because 'C'
+// would encode Black's top card as a red card.
+
+class MatchboxFileReader {
+public:
+    using Choices = MatchboxPlayer::Choices;
+    using Aging = MatchboxPlayer::Aging;
+
+    explicit MatchboxFileReader(const std::string& filename);
+    MatchboxFileReader(const MatchboxFileReader&) = delete;
+    MatchboxFileReader& operator=(const MatchboxFileReader&) = delete;
+    ~MatchboxFileReader();
+
+    bool is_open() const { return fp_ != nullptr; }
+    bool is_sorted() const { return version_ >= 1 && !is_journal_; }
+    bool is_legacy() const { return version_ == 0; }
+
+    // Returns false at end of file. Then, checksum_ok() tells whether
+    // the file was intact (legacy files and journals are accepted as-is),
+    // and is_torn() whether a legacy file or journal ended in part of a
+    // record, after good_size() bytes of whole ones.
+    bool next(PackedState& key, Choices& choices, Aging *aging = nullptr);
+    bool checksum_ok() const { return checksum_ok_; }
+    bool is_torn() const { return is_torn_; }
+    long good_size() const { return good_size_; }
+
+private:
+    FILE *fp_ = nullptr;
+    int version_ = 0;
+    bool is_journal_ = false;
+    uint64_t remaining_ = 0;
+    uint32_t checksum_ = 2166136261u;
+    bool checksum_ok_ = true;
+    bool is_torn_ = false;
+    long good_size_ = 0;
+};
+
+class MatchboxFileWriter {
+public:
+    using Choices = MatchboxPlayer::Choices;
+    using Aging = MatchboxPlayer::Aging;
+
+    // Writes to "filename" plus the suffix, then renames it over "filename"
+    // in finish(). Writers that may overlap need different suffixes.
+    explicit MatchboxFileWriter(const std::string& filename, const char *tmp_suffix = ".tmp");
+    MatchboxFileWriter(const MatchboxFileWriter&) = delete;
+    MatchboxFileWriter& operator=(const MatchboxFileWriter&) = delete;
+    ~MatchboxFileWriter();
+
+    void write(const PackedState& key, const Choices& choices, const Aging& aging = Aging());
+    void finish();
+
+private:
+    std::string filename_;
+    std::string tmpname_;
+    FILE *fp_ = nullptr;
+    uint64_t count_ = 0;
+    uint32_t checksum_ = 2166136261u;
+    PackedState last_key_;
+};
+
+// The journal is appended to directly: the header goes first, into an
+// empty file, and then the records, as they change.
+void write_journal_header(FILE *fp);
+void write_journal_record(FILE *fp, const PackedState& key, const MatchboxPlayer::Choices& choices,
+                          const MatchboxPlayer::Aging& aging);
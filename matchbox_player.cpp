@@ -1,88 +1,310 @@
 
 #include "matchbox_player.h"
+#include "matchbox_file.h"
 
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include <stdint.h>
 #include <stdio.h>
+#include <string>
+#include <tuple>
+#include <unistd.h>
 #include <utility>
+#include <vector>
 
-template<class Pair>
-static bool read_from_file(FILE *fp, Pair& kv)
+// Sets *is_legacy if the file is in the original format, unless it's empty.
+template<class Map>
+static size_t replay_file(const std::string& filename, Map& map, bool *is_legacy = nullptr)
 {
-    size_t nbytes = fread(kv.first.data_, 1, 32, fp);
-    if (nbytes != 32) {
-        assert(nbytes == 0);
-        return false;
+    size_t count = 0;
+    MatchboxFileReader reader(filename);
+    PackedState key;
+    MatchboxPlayer::Choices choices;
+    MatchboxPlayer::Aging aging;
+    while (reader.next(key, choices, &aging)) {
+        auto& e = map[key];
+        e.choices_ = choices;
+        e.aging_ = aging;
+        count += 1;
     }
-    uint8_t num_matchboxes = 0;
-    nbytes = fread(&num_matchboxes, 1, 1, fp);
-    assert(nbytes == 1);
-    assert(1 <= num_matchboxes && num_matchboxes <= 28);
-    memset(kv.second.weights_, '\0', 28);
-    nbytes = fread(kv.second.weights_, 1, num_matchboxes, fp);
-    assert(nbytes == num_matchboxes);
-    return true;
+    if (is_legacy != nullptr) {
+        *is_legacy = (count != 0 && reader.is_legacy());
+    }
+    if (!reader.checksum_ok()) {
+        fprintf(stderr, "%s: checksum mismatch; the file may be corrupt\n", filename.c_str());
+    }
+    if (reader.is_torn()) {
+        // A checkpoint crashed partway through a record. Cut it off, or the
+        // next checkpoint would append after it, out of step with the records.
+        fprintf(stderr, "%s: dropping a torn record at the end\n", filename.c_str());
+        int rc = truncate(filename.c_str(), reader.good_size());
+        assert(rc == 0);
+        (void)rc;
+    }
+    return count;
+}
+
+using Entries = std::vector<std::tuple<PackedState, MatchboxPlayer::Choices, MatchboxPlayer::Aging>>;
+
+template<class Map>
+static Entries entries_of(const Map& map)
+{
+    Entries entries;
+    entries.reserve(map.size());
+    for (const auto& kv : map) {
+        entries.emplace_back(kv.first, kv.second.choices_, kv.second.aging_);
+    }
+    return entries;
+}
+
+// Write the entries in sorted order to a temporary file and rename it over the
+// target, so that a crash leaves either the old file or the new one, never a mix.
+static void write_atomically(const std::string& filename, Entries& entries, const char *tmp_suffix = ".tmp")
+{
+    std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) { return std::get<0>(a) < std::get<0>(b); });
+    MatchboxFileWriter writer(filename, tmp_suffix);
+    for (const auto& e : entries) {
+        writer.write(std::get<0>(e), std::get<1>(e), std::get<2>(e));
+    }
+    writer.finish();
 }
 
-template<class Pair>
-static void write_to_file(FILE *fp, const Pair& kv)
+MatchboxPlayer::~MatchboxPlayer()
 {
-    fwrite(kv.first.data_, 1, 32, fp);
-    uint8_t num_matchboxes = kv.second.num_matchboxes();
-    fwrite(&num_matchboxes, 1, 1, fp);
-    fwrite(kv.second.weights_, 1, num_matchboxes, fp);
+    wait_for_compaction();
 }
 
 void MatchboxPlayer::load_from_file(const char *filename)
 {
-    if (FILE *fp = fopen(filename, "r")) {
-        std::pair<PackedState, Choices> kv;
-        while (read_from_file(fp, kv)) {
-            map_.insert(kv);
+    std::string base = filename;
+    std::string journal = base + ".journal";
+    std::string old_journal = base + ".journal.old";
+
+    // Journal entries are whole records, so replaying them in order
+    // over the base file is idempotent: last write wins.
+    std::lock_guard<std::shared_timed_mutex> lk(mtx_);
+    bool is_legacy_journal = false;
+    replay_file(base, map_);
+    size_t old_records = replay_file(old_journal, map_);
+    journal_records_ = replay_file(journal, map_, &is_legacy_journal);
+
+    // Carry on the game count where the saved entries left off, so that
+    // they don't all look as if they were seen in the future.
+    for (const auto& kv : map_) {
+        games_played_ = std::max(games_played_, kv.second.aging_.last_seen_ + 1);
+    }
+
+    if (old_records != 0 || is_legacy_journal) {
+        // We crashed during a compaction. Finish it now, so that the next
+        // compaction can't clobber the leftover journal before it's merged.
+        // A journal in the original format is folded in the same way, since
+        // new records can't be appended to it.
+        Entries entries = entries_of(map_);
+        write_atomically(base, entries);
+        remove(old_journal.c_str());
+        remove(journal.c_str());
+        journal_records_ = 0;
+    }
+    evict_if_over_cap();
+}
+
+void MatchboxPlayer::save_to_file(const char *filename)
+{
+    // The new base file has everything; any journal left over would only
+    // replay stale entries on top of it.
+    wait_for_compaction();
+    std::string base = filename;
+    Entries entries = entries_of(map_);
+    write_atomically(base, entries);
+    remove((base + ".journal.old").c_str());
+    remove((base + ".journal").c_str());
+    journal_records_ = 0;
+    dirty_.clear();
+}
+
+void MatchboxPlayer::checkpoint_to_file(const char *filename)
+{
+    std::string base = filename;
+    std::string journal = base + ".journal";
+    if (!dirty_.empty()) {
+        FILE *fp = fopen(journal.c_str(), "a");
+        assert(fp != nullptr);
+        fseek(fp, 0, SEEK_END);
+        if (ftell(fp) == 0) {
+            write_journal_header(fp);
+        }
+        for (const auto *kv : dirty_) {
+            write_journal_record(fp, kv->first, kv->second.choices_, kv->second.aging_);
         }
+        fflush(fp);
+        fsync(fileno(fp));
         fclose(fp);
+        journal_records_ += dirty_.size();
+        dirty_.clear();
+    }
+    if (journal_records_ >= std::max<size_t>(map_.size(), 4096)) {
+        compact_in_background(base);
     }
 }
 
-void MatchboxPlayer::save_to_file(const char *filename) const
+void MatchboxPlayer::compact_in_background(const std::string& base)
 {
-    FILE *fp = fopen(filename, "w");
-    for (const auto& kv : map_) {
-        write_to_file(fp, kv);
+    wait_for_compaction();
+
+    // Set the current journal aside; subsequent checkpoints start a fresh one.
+    // Until the new base file is in place, load_from_file will replay both.
+    std::string journal = base + ".journal";
+    std::string old_journal = base + ".journal.old";
+    rename(journal.c_str(), old_journal.c_str());
+    journal_records_ = 0;
+
+    auto snapshot = std::make_shared<Entries>(entries_of(map_));
+    compactor_ = std::thread([snapshot, base, old_journal]() {
+        write_atomically(base, *snapshot, ".compacting");
+        remove(old_journal.c_str());
+    });
+}
+
+void MatchboxPlayer::wait_for_compaction()
+{
+    if (compactor_.joinable()) {
+        compactor_.join();
     }
-    fclose(fp);
 }
 
-void MatchboxPlayer::record_definitely_best_move(const State& s, int move)
+bool MatchboxPlayer::move_priors(const State& s, double *priors) const
 {
     std::pair<PackedState, bool> key_flipHorizontal = s.toPackedCanonical();
-    const PackedState& key = key_flipHorizontal.first;
+    std::shared_lock<std::shared_timed_mutex> lk(mtx_);
+    auto it = map_.find(key_flipHorizontal.first);
+    if (it == map_.end()) {
+        return false;
+    }
+    const Choices& choices = it->second.choices_;
+    int sum = std::accumulate(choices.weights_, choices.weights_ + Choices::max_matchboxes, 0);
+    assert(sum > 0);
+    int columns = s.count_columns();
+    for (int m = -1; m <= columns; ++m) {
+        int i = (key_flipHorizontal.second ? columns - m - 1 : m) + 1;
+        priors[m+1] = (0 <= i && i < Choices::max_matchboxes) ? double(choices.weights_[i]) / sum : 0;
+    }
+    return true;
+}
+
+MatchboxPlayer::Choices& MatchboxPlayer::visit(const PackedState& key, int columns)
+{
     auto it = map_.find(key);
     if (it == map_.end()) {
-        it = map_.emplace(key, Choices(s.count_columns() + 1)).first;
+        it = map_.emplace(key, Entry(Choices(columns + 1))).first;
+    }
+    dirty_.insert(&*it);
+    Aging& a = it->second.aging_;
+    a.visits_ += (a.visits_ != UINT32_MAX);
+    a.last_seen_ = games_played_;
+    return it->second.choices_;
+}
+
+void MatchboxPlayer::record_move(const State& s, int move)
+{
+    std::pair<PackedState, bool> key_flipHorizontal = s.toPackedCanonical();
+    const PackedState& key = key_flipHorizontal.first;
+    std::lock_guard<std::shared_timed_mutex> lk(mtx_);
+    Choices& choices = visit(key, s.count_columns());
+    if (key_flipHorizontal.second) {
+        move = s.count_columns() - move - 1;
     }
+    history_.push_back({ &choices, move+1 });
+}
+
+void MatchboxPlayer::record_definitely_best_move(const State& s, int move)
+{
+    std::pair<PackedState, bool> key_flipHorizontal = s.toPackedCanonical();
+    const PackedState& key = key_flipHorizontal.first;
+    std::lock_guard<std::shared_timed_mutex> lk(mtx_);
+    Choices& choices = visit(key, s.count_columns());
     if (key_flipHorizontal.second) {
         move = s.count_columns() - move - 1;
     }
-    it->second.record_definitely_best_move(move);
+    choices.record_definitely_best_move(move);
 }
 
 void MatchboxPlayer::record_win_and_reset()
 {
+    std::lock_guard<std::shared_timed_mutex> lk(mtx_);
     for (const auto& cm : history_) {
         cm.first->increase_weight(cm.second);
     }
     history_.resize(0);
+    games_played_ += 1;
+    evict_if_over_cap();
 }
 
 void MatchboxPlayer::record_loss_and_reset()
 {
+    std::lock_guard<std::shared_timed_mutex> lk(mtx_);
     for (const auto& cm : history_) {
         cm.first->decrease_weight(cm.second);
     }
     history_.resize(0);
+    games_played_ += 1;
+    evict_if_over_cap();
 }
 
 void MatchboxPlayer::record_tie_and_reset()
 {
+    std::lock_guard<std::shared_timed_mutex> lk(mtx_);
     history_.resize(0);
+    games_played_ += 1;
+    evict_if_over_cap();
+}
+
+void MatchboxPlayer::evict_if_over_cap()
+{
+    // Called only between games, when nothing in history_ points into the map.
+    assert(history_.empty());
+    size_t capacity = memory_cap_ / bytes_per_entry;
+    if (memory_cap_ == 0 || map_.size() <= capacity) {
+        return;
+    }
+    // Untouched entries go first, then the least visited, then the least
+    // recently seen.
+    struct Candidate {
+        bool is_trained;
+        uint32_t visits;
+        uint32_t last_seen;
+        const Map::value_type *kv;
+    };
+    std::vector<Candidate> candidates;
+    for (const auto& kv : map_) {
+        const Entry& e = kv.second;
+        if (!e.choices_.is_definitely_best()) {
+            candidates.push_back(Candidate{ !e.choices_.is_untouched(), e.aging_.visits_, e.aging_.last_seen_, &kv });
+        }
+    }
+    size_t excess = map_.size() - capacity * 9 / 10;
+    size_t n = std::min(excess, candidates.size());
+    auto order = [](const Candidate& a, const Candidate& b) {
+        return std::tie(a.is_trained, a.visits, a.last_seen) < std::tie(b.is_trained, b.visits, b.last_seen);
+    };
+    std::nth_element(candidates.begin(), candidates.begin() + n, candidates.end(), order);
+    for (size_t i=0; i < n; ++i) {
+        const Candidate& c = candidates[i];
+        (c.is_trained ? stats_.evicted_trained : stats_.evicted_untouched) += 1;
+        PackedState key = c.kv->first;
+        dirty_.erase(c.kv);
+        map_.erase(key);
+    }
+    stats_.evictions += 1;
+}
+
+MatchboxPlayer::Stats MatchboxPlayer::stats() const
+{
+    std::shared_lock<std::shared_timed_mutex> lk(mtx_);
+    Stats result = stats_;
+    result.entries = map_.size();
+    result.capacity = memory_cap_ / bytes_per_entry;
+    result.bytes = map_.size() * bytes_per_entry;
+    return result;
 }
@@ -1,7 +1,12 @@
 #pragma once
 
+#include <mutex>
+#include <shared_mutex>
 #include <stdint.h>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -15,20 +20,42 @@ public:
         bool was_familiar;
     };
 
+    MatchboxPlayer() = default;
+    MatchboxPlayer(const MatchboxPlayer&) = delete;
+    MatchboxPlayer& operator=(const MatchboxPlayer&) = delete;
+    ~MatchboxPlayer();
+
+    // The database on disk is a base file plus an append-only journal
+    // ("matchboxes.dat.journal") of entries changed since the base was
+    // last written. checkpoint_to_file appends only the changed entries;
+    // once the journal outgrows the base, it is compacted into a new base
+    // file on a background thread, which then atomically replaces the old one.
     void load_from_file(const char *filename);
-    void save_to_file(const char *filename) const;
+    void save_to_file(const char *filename);
+    void checkpoint_to_file(const char *filename);
+    void wait_for_compaction();
 
     template<class Random>
     PickedMove pick_move(Random rand, const State& s);
 
+    // What this player has learned about s, as probabilities for the moves
+    // -1 through count_columns(), in priors[m+1]; false if s is unfamiliar.
+    // It doesn't change anything, so any number of threads can ask at once,
+    // even while the player is training.
+    bool move_priors(const State& s, double *priors) const;
+
+    // Like pick_move, but for a move we already know; used to replay old games.
+    void record_move(const State& s, int m);
+
     void record_definitely_best_move(const State& s, int m);
     void record_win_and_reset();
     void record_loss_and_reset();
     void record_tie_and_reset();
 
-private:
     struct Choices {
-        uint8_t weights_[28];
+        static constexpr int max_matchboxes = GameRules::max_cards;  // by move + 1
+
+        uint8_t weights_[max_matchboxes];
 
         Choices() = default;
 
@@ -39,17 +66,52 @@ private:
         }
 
         int num_matchboxes() const {
-            for (int i=28; i > 0; --i) {
+            for (int i=max_matchboxes; i > 0; --i) {
                 if (weights_[i-1] != 0) return i;
             }
             return 0;
         }
 
         void record_definitely_best_move(int m) {
-            memset(weights_, '\0', 28);
+            memset(weights_, '\0', max_matchboxes);
             weights_[m+1] = 16;
         }
 
+        // Training never drops a weight below 1, so a single nonzero
+        // weight can only have come from record_definitely_best_move.
+        bool is_definitely_best() const {
+            return std::count_if(weights_, weights_ + max_matchboxes, [](uint8_t w) { return w != 0; }) == 1;
+        }
+
+        bool is_untouched() const {
+            int n = num_matchboxes();
+            return n >= 2 && std::all_of(weights_, weights_ + n, [](uint8_t w) { return w == 16; });
+        }
+
+        // Reconcile the same position as learned by several independent players.
+        // Definitely-best moves are authoritative (the first one wins if they disagree);
+        // otherwise we average the weights of every player that has actually trained here.
+        static Choices merge(const Choices *cs, int n) {
+            assert(n >= 1);
+            for (int k=0; k < n; ++k) {
+                if (cs[k].is_definitely_best()) return cs[k];
+            }
+            int sums[max_matchboxes] = {};
+            int count = 0;
+            for (int k=0; k < n; ++k) {
+                if (cs[k].is_untouched()) continue;
+                for (int i=0; i < max_matchboxes; ++i) sums[i] += cs[k].weights_[i];
+                count += 1;
+            }
+            if (count == 0) return cs[0];
+            Choices result;
+            for (int i=0; i < max_matchboxes; ++i) {
+                int w = (sums[i] + count/2) / count;
+                result.weights_[i] = (sums[i] == 0) ? 0 : std::min(std::max(w, 1), 127);
+            }
+            return result;
+        }
+
         void halve_all_weights() {
             for (auto& w : weights_) {
                 w = (w == 1) ? 1 : (w / 2);
@@ -83,10 +145,10 @@ private:
 
         template<class Random>
         int pick_move(Random rand) const {
-            int sum = std::accumulate(weights_, weights_ + 28, 0);
+            int sum = std::accumulate(weights_, weights_ + max_matchboxes, 0);
             assert(sum >= 0);
             int count = rand() % sum;
-            for (int i=0; i < 28; ++i) {
+            for (int i=0; i < max_matchboxes; ++i) {
                 count -= weights_[i];
                 if (count < 0) return i-1;
             }
@@ -94,8 +156,58 @@ private:
         }
     };
 
-    std::unordered_map<PackedState, Choices> map_;
+    // How often and how lately an entry has been visited, for eviction.
+    // It's saved along with the weights, so that it survives a reload.
+    struct Aging {
+        uint32_t visits_ = 0;
+        uint32_t last_seen_ = 0;  // in games played
+    };
+
+    // The matchboxes can outgrow memory on a long run. Past the cap, at the
+    // end of a game, the least visited entries are dropped (the ones that
+    // never learned anything first, then the least recently seen) until
+    // the map is back to 90% of it. Definitely-best moves are never
+    // dropped. A dropped entry is forgotten on disk at the next compaction.
+    // The cap is in bytes, as estimated by bytes_per_entry; 0 means none.
+    void set_memory_cap(size_t bytes) { memory_cap_ = bytes; }
+
+    struct Stats {
+        size_t entries = 0;
+        size_t capacity = 0;  // in entries; 0 if there's no cap
+        size_t bytes = 0;     // estimated
+        long evictions = 0;   // each one a pass over the map
+        long evicted_untouched = 0;
+        long evicted_trained = 0;
+    };
+    Stats stats() const;
+
+private:
+    struct Entry {
+        Choices choices_;
+        Aging aging_;
+
+        Entry() = default;
+        explicit Entry(const Choices& c) : choices_(c) {}
+    };
+    using Map = std::unordered_map<PackedState, Entry>;
+
+    // A map node, plus its share of the bucket array, roughly.
+    static constexpr size_t bytes_per_entry = sizeof(Map::value_type) + 3 * sizeof(void*);
+
+    Choices& visit(const PackedState& key, int columns);
+    void evict_if_over_cap();
+    void compact_in_background(const std::string& filename);
+
+    // Held shared by move_priors, and exclusively by whatever trains.
+    mutable std::shared_timed_mutex mtx_;
+    Map map_;
     std::vector<std::pair<Choices*, int>> history_;
+    std::unordered_set<const Map::value_type*> dirty_;
+    size_t journal_records_ = 0;
+    std::thread compactor_;
+    size_t memory_cap_ = 0;
+    uint32_t games_played_ = 0;
+    Stats stats_;
 };
 
 template<class Random>
@@ -103,12 +215,9 @@ MatchboxPlayer::PickedMove MatchboxPlayer::pick_move(Random rand, const State& s
 {
     std::pair<PackedState, bool> key_flipHorizontal = s.toPackedCanonical();
     const PackedState& key = key_flipHorizontal.first;
-    auto it = map_.find(key);
-    bool was_familiar = (it != map_.end());
-    if (!was_familiar) {
-        it = map_.emplace(key, Choices(s.count_columns() + 1)).first;
-    }
-    Choices& choices = it->second;
+    std::lock_guard<std::shared_timed_mutex> lk(mtx_);
+    bool was_familiar = (map_.find(key) != map_.end());
+    Choices& choices = visit(key, s.count_columns());
     int move = choices.pick_move(rand);
     history_.push_back({ &choices, move+1 });  // when move==-1, it affects weights_[0], and so on
     if (key_flipHorizontal.second) {
@@ -0,0 +1,261 @@
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <math.h>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "engine.h"
+#include "mcts.h"
+#include "opening_book.h"
+#include "state.h"
+#include "threat_search.h"
+
+#define GREEDY_PLAYOUTS 1
+
+int monte_carlo_playouts = 0;
+
+namespace {
+
+using Rand = std::mt19937;
+using Result = std::pair<double, int>;
+
+static constexpr double exploration = 1.0;
+
+struct ChanceNode;
+
+struct DecisionNode {
+    std::mutex mtx_;
+    bool expanded_ = false;
+    std::vector<std::unique_ptr<ChanceNode>> moves_;
+    std::atomic<int> visits_ {0};
+};
+
+// The position after a move, before the mover draws a new card.
+// Its statistics are from the point of view of the player who moved.
+struct ChanceNode {
+    int move_;
+    bool is_win_;
+    std::atomic<int> visits_ {0};
+    std::atomic<int> half_points_ {0};
+    std::mutex mtx_;
+    std::unique_ptr<DecisionNode> children_[GameRules::max_value + 1];  // by the value of the mover's next card, or 0 if none are left
+
+    explicit ChanceNode(int m, bool w) : move_(m), is_win_(w) {}
+
+    DecisionNode *child(int v) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (children_[v] == nullptr) {
+            children_[v] = std::make_unique<DecisionNode>();
+        }
+        return children_[v].get();
+    }
+};
+
+int find_winning_move(const State& s)
+{
+    for (int m = -1; m <= s.count_columns(); ++m) {
+        State next = s;
+        if (next.apply_in_place_without_drawing(m)) {
+            return m;
+        }
+    }
+    return -2;
+}
+
+int draw_random_value(Rand& rand, const State& s, Color who)
+{
+    int k = s.count_unseen_cards(who);
+    if (k == 0) {
+        return 0;
+    }
+    k = rand() % k;
+    for (int v = 1; v <= GameRules::max_value; ++v) {
+        k -= s.count_unseen_cards(who, v);
+        if (k < 0) {
+            return v;
+        }
+    }
+    assert(false);
+    return 0;
+}
+
+// Returns the winner, or Nobody for a tie.
+Color playout(Rand& rand, State s)
+{
+    while (!s.is_tie_game()) {
+        Color who = s.active_player();
+#if GREEDY_PLAYOUTS
+        if (find_winning_move(s) != -2) {
+            return who;
+        }
+#endif
+        int move = int(rand() % (s.count_columns() + 2)) - 1;
+        if (s.apply_in_place(std::ref(rand), move)) {
+            return who;
+        }
+    }
+    return Nobody;
+}
+
+// Returns true if this call did the expanding.
+bool expand(DecisionNode *node, const State& s)
+{
+    std::lock_guard<std::mutex> lk(node->mtx_);
+    if (node->expanded_) {
+        return false;
+    }
+    const bool is_symmetric = s.is_mirror_symmetric();
+    for (int m = -1; m <= s.count_columns(); ++m) {
+        if (is_symmetric && s.mirror_move(m) < m) {
+            continue;
+        }
+        State next = s;
+        bool wins = next.apply_in_place_without_drawing(m);
+        node->moves_.push_back(std::make_unique<ChanceNode>(m, wins));
+    }
+    node->expanded_ = true;
+    return true;
+}
+
+ChanceNode *select(DecisionNode *node, Rand& rand)
+{
+    double log_n = log(node->visits_ + 1.0);
+    ChanceNode *best = nullptr;
+    double best_score = -1;
+    for (auto&& c : node->moves_) {
+        if (c->is_win_) {
+            return c.get();
+        }
+        int n = c->visits_;
+        double score = (n == 0) ? (1e6 + rand() % 1024) : (c->half_points_ / (2.0 * n) + exploration * sqrt(log_n / n));
+        if (score > best_score) {
+            best = c.get();
+            best_score = score;
+        }
+    }
+    assert(best != nullptr);
+    return best;
+}
+
+void search_once(DecisionNode *root, const State& root_state, Rand& rand)
+{
+    std::pair<ChanceNode*, Color> path[64];
+    int path_length = 0;
+    DecisionNode *node = root;
+    State s = root_state;
+    Color winner = Nobody;
+    while (!s.is_tie_game()) {
+        bool is_new = expand(node, s);
+        ChanceNode *c = select(node, rand);
+        Color who = s.active_player();
+
+        // The visit counts as a loss until we get back with the real result,
+        // which steers the other threads away from this line in the meantime.
+        node->visits_ += 1;
+        c->visits_ += 1;
+        assert(path_length < 64);
+        path[path_length++] = { c, who };
+
+        if (c->is_win_) {
+            winner = who;
+            break;
+        }
+        s.apply_in_place_without_drawing(c->move_);
+        int v = draw_random_value(rand, s, who);
+        if (v != 0) {
+            s.draw_this_card(who, v);
+        }
+        if (is_new) {
+            winner = playout(rand, s);
+            break;
+        }
+        node = c->child(v);
+    }
+    for (int i=0; i < path_length; ++i) {
+        const auto& cw = path[i];
+        cw.first->half_points_ += (winner == cw.second) ? 2 : (winner == Nobody) ? 1 : 0;
+    }
+}
+
+} // namespace
+
+Result monte_carlo_evaluate(LeafEvaluationFunction eval, const State& s, std::chrono::milliseconds timeout)
+{
+    return monte_carlo_evaluate(eval, s, timeout, nullptr);
+}
+
+Result monte_carlo_evaluate(LeafEvaluationFunction, const State& s, std::chrono::milliseconds timeout, SearchStats *stats)
+{
+    monte_carlo_playouts = 0;
+    if (s.is_tie_game()) {
+        return { 0, 0 };
+    }
+    Result book;
+    if (find_book_move(s, &book)) {
+        return book;
+    }
+    ProvenWin win = prove_forced_win(s);
+    if (win.is_proven) {
+        return { INT_MAX, win.move };
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    DecisionNode root;
+    std::atomic<int> playouts {0};
+    std::random_device seeder;
+    std::vector<std::thread> threads;
+    for (int i=0; i < count_search_threads(); ++i) {
+        threads.emplace_back([&, seed = seeder()]() {
+            Rand rand(seed);
+            do {
+                search_once(&root, s, rand);
+                playouts += 1;
+            } while (std::chrono::steady_clock::now() < deadline);
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    monte_carlo_playouts = playouts;
+    if (stats != nullptr) {
+        stats->nodes += playouts;
+    }
+
+    const ChanceNode *best = nullptr;
+    for (auto&& c : root.moves_) {
+        if (best == nullptr || c->visits_ > best->visits_) {
+            best = c.get();
+        }
+    }
+    assert(best != nullptr && best->visits_ > 0);
+    return { best->half_points_ / double(best->visits_) - 1, best->move_ };
+}
+
+class MonteCarloEngine : public Engine {
+public:
+    explicit MonteCarloEngine(LeafEvaluationFunction eval) : eval_(eval) {}
+
+    SearchResult search(const State& s, const SearchLimits& limits) const override {
+        assert(supports(limits));
+        SearchResult result;
+        auto vm = monte_carlo_evaluate(eval_, s, limits.time, &result.stats);
+        result.value = vm.first;
+        result.move = vm.second;
+        return result;
+    }
+
+    bool supports(const SearchLimits& limits) const override {
+        return limits.time.count() > 0 && limits.plies == 0 && limits.nodes == 0;
+    }
+
+private:
+    LeafEvaluationFunction eval_;
+};
+
+static EngineRegistration mcts_registration(
+    "mcts", "Monte Carlo tree search, for a time only; its nodes are playouts",
+    [](LeafEvaluationFunction eval) -> std::unique_ptr<Engine> { return std::make_unique<MonteCarloEngine>(eval); });
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "ab-timed.h"
+#include "state.h"
+#include <chrono>
+#include <climits>
+#include <utility>
+
+extern int monte_carlo_playouts;
+
+// Monte Carlo tree search, with the same signature as the timed expectimax
+// search, so that the two can be swapped for each other. The card draws are
+// explicit chance nodes, sampled by their probabilities; the moves are chosen
+// by UCT. As many threads as set_search_threads() asks for share one tree,
+// with a virtual loss on the way down.
+// Leaves are scored by (lightly greedy) random playouts, so `eval` is unused.
+// The value is the expected score in [-1, 1], or INT_MAX for an immediate win.
+// Like the timed search, it plays the opening book's move if there is one.
+std::pair<double, int> monte_carlo_evaluate(LeafEvaluationFunction eval, const State& s, std::chrono::milliseconds timeout);
+std::pair<double, int> monte_carlo_evaluate(LeafEvaluationFunction eval, const State& s, std::chrono::milliseconds timeout, SearchStats *stats);
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <utility>
+
+#include "ab-timed.h"
+#include "board_etc.h"
+#include "chance_expansion.h"
+#include "move_ordering.h"
+#include "state.h"
+
+#define LOOK_FOR_CHECKS 1
+
+// A move node of the timed searches (ab-timed.cpp, ab-coro.cpp), which
+// both build their nodes from this and ChanceExpansion, so that the two
+// search the same tree: the threat the mover must answer, the opening
+// moves the search assumes, the order of the moves, the leftmost of
+// several immediate wins, and the best of the children at the end.
+// Like ChanceExpansion, it's the node's logic, not its scheduling.
+
+class MoveExpansion {
+public:
+    using Result = std::pair<double, int>;
+
+    // `threat` and `shared` are from the parent's ChanceExpansion, or
+    // nullptr at the root, which works them out for itself. `depth` is in
+    // the timed search's units of two per ply.
+    explicit MoveExpansion(const State& s, int depth, const Board::ForcedMove *threat,
+                           const ChanceExpansion::Shared *shared) : s_(s), depth_(depth) {
+#if LOOK_FOR_CHECKS
+        forced_move_ = (threat != nullptr) ? *threat : s.must_respond_to_threat();
+#endif
+        if (shared != nullptr) {
+            n_ = shared->n;
+            std::copy(shared->moves, shared->moves + n_, moves_);
+        } else {
+            n_ = thread_move_ordering().ordered_moves(s, depth / 2, moves_);
+        }
+    }
+
+    // Whether the value is known without searching any move: facing two
+    // threats at once, or at one of the opening moves that the search
+    // assumes (see set_assume_opening_moves).
+    bool is_settled(Result *r) const {
+#if LOOK_FOR_CHECKS
+        if (forced_move_.is_forced && forced_move_.is_double_threat) {
+            auto win = s_.find_immediate_win();
+            if (win.is_forced) {
+                // It doesn't matter; we win first.
+                *r = { INT_MAX, win.move };
+            } else {
+                // We lose. Still, block one of the threats, in case our
+                // opponent is stupid.
+                *r = { INT_MIN, forced_move_.move };
+            }
+            return true;
+        }
+#endif
+        int columns = s_.count_columns();
+        if (columns == 0 && assumes_opening_moves()) {
+            // First move of the game; don't waste time exploring it.
+            *r = { 0, 0 };
+            return true;
+        } else if (columns == 1 && assumes_opening_moves()) {
+            // Second move of the game; I conjecture that leaving the
+            // baseline open-ended is always a mistake.
+            *r = { 1, 1 };
+            return true;
+        }
+        return false;
+    }
+
+    // The moves, best first; the caller may reorder them before expand().
+    int count() const { return n_; }
+    int *moves() { return moves_; }
+
+    // Calls add_child(m, next) for each move m to search, in order, with
+    // the position after it. That skips mirror images on a symmetric
+    // board, moves that don't answer a threat, and moves that is_wanted(m)
+    // turns down. But if a move wins outright, it returns true instead,
+    // with the leftmost such win in *win, whatever the move order.
+    template<class IsWanted, class AddChild>
+    bool expand(IsWanted is_wanted, AddChild add_child, Result *win) const {
+        // On a symmetric board, m and its mirror image lead to mirror-image
+        // positions with the same value, so search only one of them.
+        const bool is_symmetric = s_.is_mirror_symmetric();
+        auto is_searched = [&](int m) {
+            return !(is_symmetric && s_.mirror_move(m) < m) && is_wanted(m);
+        };
+        for (int i=0; i < n_; ++i) {
+            int m = moves_[i];
+            if (!is_searched(m)) {
+                continue;
+            }
+            State next = s_;
+            if (next.apply_in_place_without_drawing(m)) {
+                for (int j=0; j < n_; ++j) {
+                    State other = s_;
+                    if (moves_[j] < m && is_searched(moves_[j]) && other.apply_in_place_without_drawing(moves_[j])) {
+                        m = moves_[j];
+                    }
+                }
+                thread_move_ordering().record_good_move(s_, depth_ / 2, m, 1);
+                *win = { INT_MAX, m };
+                return true;
+            }
+#if LOOK_FOR_CHECKS
+            if (forced_move_.is_forced && m != forced_move_.move) {
+                continue;
+            }
+#endif
+            add_child(m, next);
+        }
+        return false;
+    }
+
+    // The best of n children, given result_of(i) as a (value, move) pair,
+    // for the position s at `depth`. The move is remembered in the move
+    // ordering of the calling thread, which needn't be the one that
+    // expanded the node; so this doesn't need the node itself.
+    template<class ResultOf>
+    static Result combine(const State& s, int depth, int n, ResultOf result_of) {
+        Result r = { INT_MIN, 0 };
+        for (int i=0; i < n; ++i) {
+            r = std::max(r, result_of(i));
+        }
+        if (r.first > double(INT_MIN)) {
+            thread_move_ordering().record_good_move(s, depth / 2, r.second, 1);
+        }
+        return r;
+    }
+
+private:
+    const State& s_;
+    int depth_;
+    Board::ForcedMove forced_move_ = { false, false, 0 };
+    int n_ = 0;
+    int moves_[MoveOrdering::max_moves];
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <string.h>
+
+#include "board_etc.h"
+#include "state.h"
+
+// Move ordering by the history heuristic and killer moves. The history
+// table scores a move by the color and value of the card being played and
+// the column it goes in (offset by one, so that -1 is index 0); the killer
+// table remembers the last two moves that were best at each depth.
+// Each thread has its own tables, so there is no synchronization at all.
+
+struct MoveOrdering {
+    static constexpr int max_moves = GameRules::max_moves;  // -1 through max_cards
+    static constexpr int max_depth = 64;
+
+    MoveOrdering() {
+        for (auto& k : killers_) {
+            k[0] = no_move;
+            k[1] = no_move;
+        }
+    }
+
+    // Fills moves[] with -1 through count_columns(), best first,
+    // and returns how many there are.
+    int ordered_moves(const State& s, int depth, int *moves) const {
+        int n = s.count_columns() + 2;
+        assert(n <= max_moves);
+        int scores[max_moves];
+        for (int i=0; i < n; ++i) {
+            moves[i] = i - 1;
+            scores[i] = score(s, depth, i - 1);
+        }
+        // Insertion sort: n is small, and it's stable, so ties stay in column order.
+        for (int i=1; i < n; ++i) {
+            int m = moves[i];
+            int sc = scores[i];
+            int j = i;
+            for (; j > 0 && scores[j-1] < sc; --j) {
+                moves[j] = moves[j-1];
+                scores[j] = scores[j-1];
+            }
+            moves[j] = m;
+            scores[j] = sc;
+        }
+        return n;
+    }
+
+    void record_good_move(const State& s, int depth, int m, int bonus) {
+        Card card = s.top_card(s.active_player());
+        int& h = history_[card.color()][card.value()][m+1];
+        h += bonus;
+        if (h >= (1 << 20)) {
+            age_history();
+        }
+        if (0 <= depth && depth < max_depth && killers_[depth][0] != m) {
+            killers_[depth][1] = killers_[depth][0];
+            killers_[depth][0] = m;
+        }
+    }
+
+private:
+    static constexpr int killer_score = (1 << 30);
+    static constexpr int no_move = -2;
+
+    int score(const State& s, int depth, int m) const {
+        if (0 <= depth && depth < max_depth) {
+            if (killers_[depth][0] == m) return killer_score;
+            if (killers_[depth][1] == m) return killer_score - 1;
+        }
+        Card card = s.top_card(s.active_player());
+        return history_[card.color()][card.value()][m+1];
+    }
+
+    void age_history() {
+        for (auto& by_value : history_) {
+            for (auto& by_move : by_value) {
+                for (int& h : by_move) {
+                    h /= 2;
+                }
+            }
+        }
+    }
+
+    int history_[2][GameRules::max_value + 1][max_moves] = {};
+    int killers_[max_depth][2] = {};
+};
+
+inline MoveOrdering& thread_move_ordering()
+{
+    static thread_local MoveOrdering mo;
+    return mo;
+}
@@ -0,0 +1,173 @@
+#include "opening_book.h"
+
+#include <assert.h>
+#include <climits>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char magic[4] = { 'C', '1', '5', 'B' };
+static const int current_version = 1;
+static const size_t header_size = 16;
+
+static void put_le(uint8_t *p, uint64_t x, int n)
+{
+    for (int i=0; i < n; ++i) {
+        p[i] = (x >> (8*i));
+    }
+}
+
+static uint64_t get_le(const uint8_t *p, int n)
+{
+    uint64_t x = 0;
+    for (int i=n-1; i >= 0; --i) {
+        x = (x << 8) | p[i];
+    }
+    return x;
+}
+
+OpeningBook::~OpeningBook()
+{
+    close();
+}
+
+bool OpeningBook::open(const std::string& filename)
+{
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < header_size) {
+        ::close(fd);
+        return false;
+    }
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    map_ = p;
+    map_size_ = st.st_size;
+
+    const uint8_t *header = static_cast<const uint8_t*>(p);
+    uint64_t count = get_le(header + 8, 8);
+    if (memcmp(header, magic, 4) != 0 || get_le(header + 4, 4) != current_version ||
+        map_size_ != header_size + count * record_size) {
+        fprintf(stderr, "%s: not a version-%d opening book\n", filename.c_str(), current_version);
+        close();
+        return false;
+    }
+    records_ = header + header_size;
+    count_ = count;
+    return true;
+}
+
+void OpeningBook::close()
+{
+    if (map_ != nullptr) {
+        munmap(map_, map_size_);
+    }
+    map_ = nullptr;
+    map_size_ = 0;
+    records_ = nullptr;
+    count_ = 0;
+}
+
+bool OpeningBook::lookup(const State& s, std::pair<double, int> *result) const
+{
+    if (count_ == 0) {
+        return false;
+    }
+    auto canonical = s.toPackedCanonical();
+    size_t lo = 0;
+    size_t hi = count_;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const uint8_t *r = records_ + mid * record_size;
+        int cmp = memcmp(r, canonical.first.data_, PackedState::size);
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else if (cmp > 0) {
+            hi = mid;
+        } else {
+            uint32_t bits = get_le(r + PackedState::size, 4);
+            float value;
+            memcpy(&value, &bits, 4);
+            int move = int8_t(r[PackedState::size + 4]);
+            if (canonical.second) {
+                move = s.mirror_move(move);
+            }
+            // A float can't hold INT_MAX exactly; keep proven wins recognizable.
+            double v = (value >= float(INT_MAX)) ? double(INT_MAX) : (value <= float(INT_MIN)) ? double(INT_MIN) : double(value);
+            *result = { v, move };
+            return true;
+        }
+    }
+    return false;
+}
+
+OpeningBookWriter::OpeningBookWriter(const std::string& filename) :
+    filename_(filename), tmpname_(filename + ".tmp")
+{
+    fp_ = fopen(tmpname_.c_str(), "w");
+    assert(fp_ != nullptr);
+    uint8_t header[header_size] = {};
+    fwrite(header, 1, header_size, fp_);  // filled in by finish()
+}
+
+OpeningBookWriter::~OpeningBookWriter()
+{
+    if (fp_ != nullptr) {
+        fclose(fp_);
+        remove(tmpname_.c_str());
+    }
+}
+
+void OpeningBookWriter::write(const PackedState& key, double value, int move)
+{
+    assert(count_ == 0 || last_key_ < key);
+    assert(-1 <= move && move <= GameRules::max_cards);
+    last_key_ = key;
+    uint8_t record[OpeningBook::record_size] = {};
+    memcpy(record, key.data_, PackedState::size);
+    float f = value;
+    uint32_t bits;
+    memcpy(&bits, &f, 4);
+    put_le(record + PackedState::size, bits, 4);
+    record[PackedState::size + 4] = uint8_t(int8_t(move));
+    fwrite(record, 1, sizeof record, fp_);
+    count_ += 1;
+}
+
+void OpeningBookWriter::finish()
+{
+    uint8_t header[header_size];
+    memcpy(header, magic, 4);
+    put_le(header + 4, current_version, 4);
+    put_le(header + 8, count_, 8);
+    fseek(fp_, 0, SEEK_SET);
+    fwrite(header, 1, header_size, fp_);
+
+    fflush(fp_);
+    fsync(fileno(fp_));
+    fclose(fp_);
+    fp_ = nullptr;
+    rename(tmpname_.c_str(), filename_.c_str());
+}
+
+static OpeningBook g_book;
+
+bool load_opening_book(const std::string& filename)
+{
+    return g_book.open(filename);
+}
+
+bool find_book_move(const State& s, std::pair<double, int> *result)
+{
+    return g_book.lookup(s, result);
+}
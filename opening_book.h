@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <utility>
+
+#include "packed_state.h"
+#include "state.h"
+
+// Version 1 of the opening book format (see main-book.cpp, which builds it):
+//
+//     "C15B"  uint32 version  uint64 record_count     (little-endian)
+//     record_count records of 40 bytes, sorted by strictly increasing key:
+//         canonical PackedState (32 bytes in the standard game), float32 value, int8 move, 3 zero bytes
+//
+// The move is stored for the canonical orientation of the position, so a
+// position and its mirror image share one record. The file is mapped into
+// memory as-is, and looked up by binary search.
+
+class OpeningBook {
+public:
+    static constexpr int record_size = PackedState::size + 8;
+
+    OpeningBook() = default;
+    OpeningBook(const OpeningBook&) = delete;
+    OpeningBook& operator=(const OpeningBook&) = delete;
+    ~OpeningBook();
+
+    // Returns false, and leaves the book empty, if the file is missing or bad.
+    bool open(const std::string& filename);
+    void close();
+
+    bool is_open() const { return records_ != nullptr; }
+    size_t size() const { return count_; }
+
+    // The stored value and best move for s, mirrored back if need be.
+    bool lookup(const State& s, std::pair<double, int> *result) const;
+
+private:
+    void *map_ = nullptr;
+    size_t map_size_ = 0;
+    const uint8_t *records_ = nullptr;
+    size_t count_ = 0;
+};
+
+class OpeningBookWriter {
+public:
+    explicit OpeningBookWriter(const std::string& filename);
+    OpeningBookWriter(const OpeningBookWriter&) = delete;
+    OpeningBookWriter& operator=(const OpeningBookWriter&) = delete;
+    ~OpeningBookWriter();
+
+    // Keys must be canonical, and come in strictly increasing order.
+    void write(const PackedState& key, double value, int move);
+    void finish();
+
+private:
+    std::string filename_;
+    std::string tmpname_;
+    FILE *fp_ = nullptr;
+    PackedState last_key_;
+    uint64_t count_ = 0;
+};
+
+// The book the engines consult before searching: the timed search, the
+// TimeManager and the Monte Carlo search all play a book move at once.
+// Load it before the first search; there's no book until then.
+bool load_opening_book(const std::string& filename);
+bool find_book_move(const State& s, std::pair<double, int> *result);
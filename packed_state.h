@@ -4,28 +4,35 @@
 #include <string>
 #include <string.h>
 
+#include "rules.h"
+
+// A State in nibbles: the two top cards, then each column's cards and an
+// empty card after it. That's 29 bytes for the standard game; keys are
+// 32 bytes, unless a larger variant needs more.
 struct PackedState {
-    uint8_t data_[32] = {};
+    static constexpr size_t size = (GameRules::max_cards + 1 > 32) ? GameRules::max_cards + 1 : 32;
+
+    uint8_t data_[size] = {};
 
     PackedState() = default;
 
     friend bool operator==(const PackedState& a, const PackedState& b) {
-        return memcmp(a.data_, b.data_, 32) == 0;
+        return memcmp(a.data_, b.data_, size) == 0;
     }
     friend bool operator!=(const PackedState& a, const PackedState& b) {
-        return memcmp(a.data_, b.data_, 32) != 0;
+        return memcmp(a.data_, b.data_, size) != 0;
     }
     friend bool operator<(const PackedState& a, const PackedState& b) {
-        return memcmp(a.data_, b.data_, 32) < 0;
+        return memcmp(a.data_, b.data_, size) < 0;
     }
     friend bool operator>(const PackedState& a, const PackedState& b) {
-        return memcmp(a.data_, b.data_, 32) > 0;
+        return memcmp(a.data_, b.data_, size) > 0;
     }
     friend bool operator<=(const PackedState& a, const PackedState& b) {
-        return memcmp(a.data_, b.data_, 32) <= 0;
+        return memcmp(a.data_, b.data_, size) <= 0;
     }
     friend bool operator>=(const PackedState& a, const PackedState& b) {
-        return memcmp(a.data_, b.data_, 32) >= 0;
+        return memcmp(a.data_, b.data_, size) >= 0;
     }
 };
 
@@ -33,9 +40,9 @@ template<>
 struct std::hash<PackedState> {
     size_t operator()(const PackedState& x) const {
 #if defined(_LIBCPP_VERSION)
-        return std::__do_string_hash(x.data_, x.data_ + 32);
+        return std::__do_string_hash(x.data_, x.data_ + PackedState::size);
 #elif defined(__GLIBCXX__)
-        return std::_Hash_bytes(x.data_, 32, 0xC70F6907uL);
+        return std::_Hash_bytes(x.data_, PackedState::size, 0xC70F6907uL);
 #endif
     }
 };
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "board_etc.h"
+#include "state.h"
+
+// A one-line text form of a position, for test files and batch analysis:
+//
+//     3r 6b 5r 4r 1b 2r / 1r 4b 6r 3b ; 7r 4b ; r
+//
+// The columns from left to right, separated by '/', each listing its cards
+// from the bottom up; then Red's and Black's top cards ("..", if none);
+// then the side to move. An empty board is an empty first field.
+
+inline bool parse_card(const std::string& word, Card *card)
+{
+    if (word == "..") {
+        *card = Card();
+        return true;
+    }
+    if (word.size() != 2 || word[0] < '1' || word[0] > '0' + GameRules::max_value || (word[1] != 'r' && word[1] != 'b')) {
+        return false;
+    }
+    *card = Card(word.c_str());
+    return true;
+}
+
+inline std::unique_ptr<State> parse_position(const std::string& line, std::string *error)
+{
+    auto fail = [&](std::string msg) {
+        *error = std::move(msg);
+        return nullptr;
+    };
+
+    std::vector<std::string> fields;
+    std::string field;
+    std::istringstream fs(line);
+    while (std::getline(fs, field, ';')) {
+        fields.push_back(field);
+    }
+    if (fields.size() != 3) {
+        return fail("expected three fields separated by ';'");
+    }
+
+    int seen[2][8] = {};
+    std::vector<std::vector<Card>> cols;
+    std::string word;
+    std::string board_text;
+    for (char ch : fields[0]) {
+        board_text += (ch == '/') ? std::string(" / ") : std::string(1, ch);
+    }
+    std::istringstream bs(board_text);
+    bool at_column_start = true;
+    while (bs >> word) {
+        if (word == "/") {
+            if (at_column_start) {
+                return fail("empty column");
+            }
+            at_column_start = true;
+            continue;
+        }
+        Card card;
+        if (!parse_card(word, &card) || card.color() == Nobody) {
+            return fail("bad card '" + word + "'");
+        }
+        if (at_column_start) {
+            cols.emplace_back();
+            at_column_start = false;
+        }
+        if (cols.back().size() == GameRules::max_cards) {
+            return fail("column too tall");
+        }
+        cols.back().push_back(card);
+        seen[card.color()][card.value()] += 1;
+    }
+    if (at_column_start && !cols.empty()) {
+        return fail("empty column");
+    }
+
+    Card top[2];
+    std::istringstream ts(fields[1]);
+    for (int w=0; w < 2; ++w) {
+        if (!(ts >> word) || !parse_card(word, &top[w])) {
+            return fail("expected two top cards");
+        }
+        if (top[w].color() != Nobody) {
+            if (top[w].color() != Color(w)) {
+                return fail("top card '" + word + "' has the wrong color");
+            }
+            seen[w][top[w].value()] += 1;
+        }
+    }
+    if (ts >> word) {
+        return fail("expected two top cards");
+    }
+
+    Color who;
+    std::istringstream ws(fields[2]);
+    if (!(ws >> word) || (word != "r" && word != "b") || (ws >> word)) {
+        return fail("expected 'r' or 'b' to move");
+    }
+    who = (word == "r") ? Red : Black;
+
+    for (int w=0; w < 2; ++w) {
+        for (int v=1; v <= GameRules::max_value; ++v) {
+            if (seen[w][v] > GameRules::copies) {
+                return fail("too many copies of " + Card(Color(w), v).toString());
+            }
+        }
+    }
+    return std::make_unique<State>(who, top[Red], top[Black], Board(std::move(cols)));
+}
+
+inline std::string format_position(const State& s)
+{
+    std::string result;
+    const Board& b = s.board();
+    for (int i=0; i < b.count_columns(); ++i) {
+        if (i != 0) {
+            result += " / ";
+        }
+        Column col = b.column(i);
+        for (int j=0; j < col.size(); ++j) {
+            if (j != 0) {
+                result += " ";
+            }
+            result += col[j].toString();
+        }
+    }
+    result += " ; " + s.top_card(Red).toString() + " " + s.top_card(Black).toString();
+    result += (s.active_player() == Red) ? " ; r" : " ; b";
+    return result;
+}
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <utility>
+#include <vector>
+
+#include "ab-timed.h"
+#include "board_etc.h"
+#include "packed_state.h"
+#include "state.h"
+
+// Slow, plainly written versions of the kernels that Board, State and the
+// timed search optimize, for main-tests.cpp to check those against and
+// main-bench.cpp to time them beside. The board here is just a vector of
+// columns, every win is found by walking the grid in all four directions,
+// and the search is the bare recursion, with no tasks, no shared chance
+// expansions and no move ordering. They play by the same rules, so every
+// answer has to agree exactly.
+
+namespace reference {
+
+using Columns = std::vector<std::vector<Card>>;
+
+inline Columns columns_of(const Board& b)
+{
+    Columns cols;
+    for (int x=0; x < b.count_columns(); ++x) {
+        Column col = b.column(x);
+        cols.emplace_back();
+        for (int y=0; y < col.size(); ++y) {
+            cols.back().push_back(col[y]);
+        }
+    }
+    return cols;
+}
+
+// Column -1 is a new column at the left; count_columns() is one at the right.
+inline void play(Columns& cols, int column, Card card)
+{
+    if (column == -1) {
+        cols.insert(cols.begin(), std::vector<Card>{ card });
+    } else if (column == int(cols.size())) {
+        cols.push_back({ card });
+    } else {
+        cols[column].push_back(card);
+    }
+}
+
+// Whether `card`, just played in `column`, is in a line of its color
+// (up and down, across, or on either diagonal) that reaches the target.
+inline bool is_win_involving(const Columns& cols, int column, Card card)
+{
+    int x = (column == -1) ? 0 : column;
+    int y = int(cols[x].size()) - 1;
+    auto at = [&](int i, int j) {
+        bool on_board = (0 <= i && i < int(cols.size()) && 0 <= j && j < int(cols[i].size()));
+        return on_board ? cols[i][j] : Card();
+    };
+    const int directions[4][2] = { {0, 1}, {1, 0}, {1, 1}, {1, -1} };
+    for (auto&& d : directions) {
+        int sum = card.value();
+        for (int sign : { 1, -1 }) {
+            for (int k=1; at(x + sign*k*d[0], y + sign*k*d[1]).color() == card.color(); ++k) {
+                sum += at(x + sign*k*d[0], y + sign*k*d[1]).value();
+            }
+        }
+        if (sum >= GameRules::target_sum) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Every move with which `card` wins: the first, and whether there's another.
+inline ForcedMove must_respond_to_threat(const Columns& cols, Card card)
+{
+    std::vector<int> wins;
+    for (int m = -1; m <= int(cols.size()); ++m) {
+        Columns next = cols;
+        play(next, m, card);
+        if (is_win_involving(next, m, card)) {
+            wins.push_back(m);
+        }
+    }
+    if (wins.empty()) {
+        return { false, false, 0 };
+    }
+    return { true, wins.size() >= 2, wins[0] };
+}
+
+inline State mirror_image(const State& s)
+{
+    Columns cols = columns_of(s.board());
+    std::reverse(cols.begin(), cols.end());
+    return State(s.active_player(), s.top_card(Red), s.top_card(Black), Board(std::move(cols)));
+}
+
+// Nibble by nibble, high nibble first: the top cards, then each column
+// and an empty card after it, with Black's cards as their value plus 8.
+inline PackedState pack(const State& s, bool flipHorizontal)
+{
+    std::vector<int> nibbles;
+    auto nibble_of = [](Card c) { return (c.color() == Nobody) ? 0 : c.value() + 8 * c.color(); };
+    nibbles.push_back(nibble_of(s.top_card(Red)));
+    nibbles.push_back(nibble_of(s.top_card(Black)));
+    Columns cols = columns_of(s.board());
+    if (flipHorizontal) {
+        std::reverse(cols.begin(), cols.end());
+    }
+    for (auto&& col : cols) {
+        for (Card c : col) {
+            nibbles.push_back(nibble_of(c));
+        }
+        nibbles.push_back(0);
+    }
+    PackedState p;
+    for (int i=0; i < int(nibbles.size()); ++i) {
+        p.data_[i / 2] |= (i % 2 == 0) ? (nibbles[i] << 4) : nibbles[i];
+    }
+    return p;
+}
+
+// The lesser of the two orientations, and whether it's the flipped one,
+// which it is on a symmetric board.
+inline std::pair<PackedState, bool> pack_canonical(const State& s)
+{
+    PackedState p = pack(s, false);
+    PackedState flipped = pack(s, true);
+    return (p < flipped) ? std::make_pair(p, false) : std::make_pair(flipped, true);
+}
+
+// The deterministic timed search, as deterministically_evaluate runs it to
+// a depth (with its depth counted in tasks, two per ply), but for proving
+// forced wins first. Values are from the point of view of the player to move.
+inline double expect_card(LeafEvaluationFunction eval, const State& s, int depth, int max_depth);
+
+inline std::pair<double, int> pick_move(LeafEvaluationFunction eval, const State& s, int depth, int max_depth)
+{
+    if (s.is_tie_game() || depth >= max_depth) {
+        return { eval(s), 0 };
+    }
+    ForcedMove forced = s.must_respond_to_threat();
+    if (forced.is_double_threat) {
+        ForcedMove win = s.find_immediate_win();
+        return win.is_forced ? std::make_pair(double(INT_MAX), win.move) : std::make_pair(double(INT_MIN), forced.move);
+    }
+    if (assumes_opening_moves() && s.count_columns() == 0) {
+        return { 0, 0 };
+    } else if (assumes_opening_moves() && s.count_columns() == 1) {
+        return { 1, 1 };
+    }
+    std::pair<double, int> best = { INT_MIN, 0 };
+    for (int m = -1; m <= s.count_columns(); ++m) {
+        State next = s;
+        if (next.apply_in_place_without_drawing(m)) {
+            return { INT_MAX, m };
+        }
+        if (forced.is_forced && m != forced.move) {
+            continue;
+        }
+        best = std::max(best, std::make_pair(expect_card(eval, next, depth+1, max_depth), m));
+    }
+    return best;
+}
+
+// A player has just moved, without drawing; each card they might draw is
+// weighted by how many of it they have left. The value is theirs.
+inline double expect_card(LeafEvaluationFunction eval, const State& s, int depth, int max_depth)
+{
+    Color drawer = Color(1 - s.active_player());
+    std::vector<std::pair<int, double>> weighted_values;
+    for (int v = 1; v <= GameRules::max_value; ++v) {
+        if (s.count_unseen_cards(drawer, v) != 0) {
+            State next = s;
+            next.draw_this_card(drawer, v);
+            weighted_values.emplace_back(s.count_unseen_cards(drawer, v), pick_move(eval, next, depth+1, max_depth).first);
+        }
+    }
+    if (weighted_values.empty()) {
+        weighted_values.emplace_back(1, pick_move(eval, s, depth+1, max_depth).first);
+    }
+    // The values are the next mover's. If they lose whatever is drawn,
+    // the drawer has won; if they win after some draw, the rest count
+    // for at most 20.
+    bool all_losses = true;
+    bool any_win = false;
+    for (auto&& wv : weighted_values) {
+        all_losses = all_losses && (wv.second <= double(INT_MIN+1));
+        any_win = any_win || (wv.second >= double(INT_MAX-1));
+    }
+    if (all_losses) {
+        return INT_MAX;
+    }
+    double sum = 0;
+    int count = 0;
+    for (auto&& wv : weighted_values) {
+        sum += wv.first * std::min(wv.second, any_win ? 20.0 : double(INT_MAX));
+        count += wv.first;
+    }
+    return -sum / count;
+}
+
+inline std::pair<double, int> evaluate_to_depth(LeafEvaluationFunction eval, const State& s, int plies)
+{
+    return pick_move(eval, s, 0, 2 * plies);
+}
+
+// What playing m is worth to the player to move, in the same search; the
+// best move is any whose value is the best value.
+inline double value_of_move(LeafEvaluationFunction eval, const State& s, int plies, int m)
+{
+    State next = s;
+    if (next.apply_in_place_without_drawing(m)) {
+        return INT_MAX;
+    }
+    return expect_card(eval, next, 1, 2 * plies);
+}
+
+} // namespace reference
@@ -0,0 +1,37 @@
+#pragma once
+
+// The rules of the game, as compile-time constants, so that the board and
+// state (and their win checks and packing) are instantiated per variant
+// and the hot loops fold them in. The standard game is Rules<15, 7, 2>:
+// each player has two each of the cards 1 through 7, and a line of one
+// color that sums to 15 wins.
+//
+// A build plays one variant, GAME_RULES, which make sets from RULES:
+//
+//     make -B RULES="Rules<10, 5, 2>" tests
+//
+// Saved matchboxes and opening books are only good for the variant that
+// wrote them.
+
+template<int TargetSum, int MaxValue, int Copies>
+struct Rules {
+    static constexpr int target_sum = TargetSum;
+    static constexpr int max_value = MaxValue;
+    static constexpr int copies = Copies;
+    static constexpr int cards_per_player = MaxValue * Copies;
+    static constexpr int max_cards = 2 * cards_per_player;  // on the board when they've all been played
+    static constexpr int max_moves = max_cards + 2;  // -1 through max_cards
+
+    // A Card keeps its value in three bits, beside its color.
+    static_assert(1 <= MaxValue && MaxValue <= 7, "card values are 1 through 7 at most");
+    static_assert(1 <= Copies && 2 * MaxValue * Copies <= 126, "the board counts cards in int8_t");
+    static_assert(TargetSum > MaxValue, "a single card shouldn't win");
+};
+
+using StandardRules = Rules<15, 7, 2>;
+
+#ifndef GAME_RULES
+#define GAME_RULES StandardRules
+#endif
+
+using GameRules = GAME_RULES;
@@ -5,39 +5,66 @@
 #include <cstdint>
 #include <numeric>
 #include <string>
+#include <type_traits>
+#include <utility>
 
 #include "board_etc.h"
 #include "nibble_writer.h"
 #include "packed_state.h"
+#include "rules.h"
 
-struct State {
-    explicit State(Color who, Card top_red, Card top_black, Board b) :
+// A position: the board, both top cards, the cards not yet seen, and whose
+// move it is; for the Rules R, like BasicBoard. Everything else uses State.
+template<class R>
+struct BasicState {
+    using Board = BasicBoard<R>;
+    static_assert(R::max_cards + 1 <= PackedState::size, "the packed form must fit");
+
+    explicit BasicState(Color who, Card top_red, Card top_black, Board b) :
         board_(std::move(b)),
         top_card_{top_red, top_black},
         who_(who)
     {
         board_.populate_unseen_cards(unseen_cards_);
+        // The top cards have been seen too. Some hand-written positions show
+        // a third copy of a card, so don't go below zero for them.
+        for (const Card& card : top_card_) {
+            if (card.color() != Nobody && unseen_cards_[card.color()][card.value()] > 0) {
+                unseen_cards_[card.color()][card.value()] -= 1;
+            }
+        }
     }
 
     template<class Random>
-    static State initial(Random rand) {
-        State s;
-        for (int v=1; v <= 7; ++v) {
-            s.unseen_cards_[Red][v] = 2;
-            s.unseen_cards_[Black][v] = 2;
+    static BasicState initial(Random rand) {
+        BasicState s;
+        for (int v=1; v <= R::max_value; ++v) {
+            s.unseen_cards_[Red][v] = R::copies;
+            s.unseen_cards_[Black][v] = R::copies;
         }
         s.draw_random_card(rand, Red);
         s.draw_random_card(rand, Black);
         return s;
     }
 
+    static BasicState initial(int red_value, int black_value) {
+        BasicState s;
+        for (int v=1; v <= R::max_value; ++v) {
+            s.unseen_cards_[Red][v] = R::copies;
+            s.unseen_cards_[Black][v] = R::copies;
+        }
+        s.draw_this_card(Red, red_value);
+        s.draw_this_card(Black, black_value);
+        return s;
+    }
+
     template<class Random>
     void draw_random_card(Random rand, Color who) {
         int sum = count_unseen_cards(who);
         if (sum == 0) {
             top_card_[who] = Card();
         } else {
-            assert(0 < sum && sum <= 14);
+            assert(0 < sum && sum <= R::cards_per_player);
             int k = rand() % sum;
             int v = 0;
             while (k >= 0) {
@@ -48,7 +75,7 @@ struct State {
     }
 
     void draw_this_card(Color who, int v) {
-        assert(1 <= v && v <= 7);
+        assert(1 <= v && v <= R::max_value);
         assert(unseen_cards_[who][v] >= 1);
         unseen_cards_[who][v] -= 1;
         top_card_[who] = Card(who, v);
@@ -95,11 +122,19 @@ struct State {
         return who_;
     }
 
+    const Board& board() const {
+        return board_;
+    }
+
+    Card top_card(Color who) const {
+        return top_card_[who];
+    }
+
     bool is_tie_game() const {
         return top_card_[who_].color() == Nobody;
     }
 
-    Board::ForcedMove must_respond_to_threat() const {
+    ForcedMove must_respond_to_threat() const {
         Color whont = Color(1 - who_);
         if (top_card_[whont].color() == Nobody) {
             return { false, false, 0 };
@@ -107,6 +142,14 @@ struct State {
         return board_.must_respond_to_threat(top_card_[whont]);
     }
 
+    // The same thing from the other side: can the active player win right now?
+    ForcedMove find_immediate_win() const {
+        if (top_card_[who_].color() == Nobody) {
+            return { false, false, 0 };
+        }
+        return board_.must_respond_to_threat(top_card_[who_]);
+    }
+
     bool apply_in_place_without_drawing(int column) {
         Card card = std::exchange(top_card_[who_], Card());
         board_.apply_in_place(column, card);
@@ -124,30 +167,39 @@ struct State {
     }
 
     template<class Random>
-    State apply(Random rand, int column) const {
-        State next = *this;
+    BasicState apply(Random rand, int column) const {
+        BasicState next = *this;
         next.apply_in_place(rand, column);
         return next;
     }
 
     int count_columns() const { return board_.count_columns(); }
+    int mirror_move(int m) const { return board_.mirror_move(m); }
+
+    // The top cards and unseen cards don't care about left and right,
+    // so the position is symmetric exactly when the board is.
+    bool is_mirror_symmetric() const { return board_.is_mirror_symmetric(); }
 
     int count_unseen_cards(Color who, int v) const {
-        assert(1 <= v && v <= 7);
+        assert(1 <= v && v <= R::max_value);
         return unseen_cards_[who][v];
     }
 
     int count_unseen_cards(Color who) const {
         int sum = std::accumulate(std::begin(unseen_cards_[who]), std::end(unseen_cards_[who]), 0);
-        assert(0 <= sum && sum <= 14);
+        assert(0 <= sum && sum <= R::cards_per_player);
         return sum;
     }
 
 private:
-    explicit State() = default;
+    explicit BasicState() = default;
 
     Board board_;
-    int8_t unseen_cards_[2][8] = {};
+    int8_t unseen_cards_[2][R::max_value + 1] = {};
     Card top_card_[2];
     Color who_ = Red;
 };
+
+using State = BasicState<GameRules>;
+static_assert(sizeof(State) <= 128 || State::Board::max_cards > 28, "State should fit in two cache lines");
+static_assert(std::is_trivially_copyable<State>::value, "State should copy without allocating");
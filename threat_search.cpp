@@ -0,0 +1,111 @@
+#include "threat_search.h"
+#include "state.h"
+
+namespace {
+
+struct Prover {
+    long max_nodes_;
+    long nodes_ = 0;
+
+    bool out_of_nodes() const { return nodes_ >= max_nodes_; }
+
+    // Having made the move that left `s`, with the opponent to move and our
+    // next card not yet drawn: do we win against every draw and every reply?
+    bool is_forced_after(const State& s, int threats_left) {
+        Color us = Color(1 - s.active_player());
+        Color them = s.active_player();
+        if (s.find_immediate_win().is_forced) {
+            return false;  // they win first
+        }
+        if (s.count_unseen_cards(us) == 0) {
+            return false;
+        }
+        for (int v = 1; v <= GameRules::max_value; ++v) {
+            if (s.count_unseen_cards(us, v) == 0) {
+                continue;
+            }
+            State drawn = s;
+            drawn.draw_this_card(us, v);
+            auto threat = drawn.must_respond_to_threat();
+            if (!threat.is_forced) {
+                return false;  // with this card, we don't threaten anything
+            }
+            if (threat.is_double_threat) {
+                continue;  // they can only block one
+            }
+            if (threats_left == 0) {
+                return false;
+            }
+            State blocked = drawn;
+            blocked.apply_in_place_without_drawing(threat.move);
+            if (!is_won_against_every_draw(blocked, them, threats_left)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool is_won_against_every_draw(const State& s, Color them, int threats_left) {
+        if (s.count_unseen_cards(them) == 0) {
+            return find_forced_win(s, threats_left).is_proven;
+        }
+        for (int w = 1; w <= GameRules::max_value; ++w) {
+            if (s.count_unseen_cards(them, w) == 0) {
+                continue;
+            }
+            State next = s;
+            next.draw_this_card(them, w);
+            if (!find_forced_win(next, threats_left).is_proven) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    ProvenWin find_forced_win(const State& s, int threats_left) {
+        nodes_ += 1;
+        if (s.is_tie_game() || out_of_nodes()) {
+            return { false, 0 };
+        }
+        auto win = s.find_immediate_win();
+        if (win.is_forced) {
+            return { true, win.move };
+        }
+        if (threats_left == 0) {
+            return { false, 0 };
+        }
+        auto forced = s.must_respond_to_threat();
+        if (forced.is_double_threat) {
+            return { false, 0 };
+        }
+        const bool is_symmetric = s.is_mirror_symmetric();
+        for (int m = -1; m <= s.count_columns(); ++m) {
+            if (forced.is_forced && m != forced.move) {
+                continue;  // anything else loses on the spot
+            }
+            if (is_symmetric && s.mirror_move(m) < m) {
+                continue;
+            }
+            State next = s;
+            next.apply_in_place_without_drawing(m);
+            if (is_forced_after(next, threats_left - 1)) {
+                return { true, m };
+            }
+        }
+        return { false, 0 };
+    }
+};
+
+} // namespace
+
+ProvenWin prove_forced_win(const State& s, int max_threats, long max_nodes)
+{
+    Prover p { max_nodes };
+    ProvenWin result = { false, 0 };
+    // Deepen gradually, so that we find the shortest win first.
+    for (int threats = 0; threats <= max_threats && !result.is_proven && !p.out_of_nodes(); ++threats) {
+        result = p.find_forced_win(s, threats);
+    }
+    result.nodes = p.nodes_;
+    return result;
+}
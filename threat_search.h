@@ -0,0 +1,17 @@
+#pragma once
+
+#include "state.h"
+
+struct ProvenWin {
+    bool is_proven;
+    int move;
+    long nodes = 0;  // searched, whether the win was proven or not
+};
+
+// Threat-space search: tries to prove that the active player can force a win
+// by a sequence of at most `max_threats` threats, no matter which cards either
+// player draws. It only looks at moves after which, for every card we might
+// draw, the opponent has no immediate win and must block a threat (or can't
+// block two). That keeps the tree narrow enough to see much deeper than the
+// full-width search does in the same time. Gives up after `max_nodes` nodes.
+ProvenWin prove_forced_win(const State& s, int max_threats = 6, long max_nodes = 20000);
@@ -0,0 +1,123 @@
+#include "time_manager.h"
+
+#include <algorithm>
+#include <climits>
+#include "ab-timed.h"
+#include "opening_book.h"
+#include "state.h"
+#include "threat_search.h"
+
+using Result = std::pair<double, int>;
+
+TimeManager::Clock::duration TimeManager::allocate(const State& s) const
+{
+    // There's one move per card left to play, but games rarely last that
+    // long; plan for about nine moves a side, and a couple more after that.
+    int moves_made = GameRules::cards_per_player - 1 - s.count_unseen_cards(s.active_player());
+    int moves_left = std::min(s.count_unseen_cards(s.active_player()) + 1, std::max(2, 9 - moves_made));
+    double breadth = std::min(1.25, std::max(0.5, (s.count_columns() + 2) / 8.0));
+    Clock::duration share = std::chrono::duration_cast<Clock::duration>(remaining_ * breadth / moves_left);
+    // Never more than is left, so that the clock doesn't run out before the
+    // last move, but at least a millisecond, even once it has.
+    const Clock::duration min_share = std::chrono::milliseconds(1);
+    return std::max(std::min(share, remaining_), min_share);
+}
+
+Result TimeManager::finish(Clock::time_point start, Result result)
+{
+    Clock::duration elapsed = Clock::now() - start;
+    used_ += elapsed;
+    remaining_ = std::max(remaining_ - elapsed, Clock::duration(0));
+    return result;
+}
+
+Result TimeManager::evaluate(LeafEvaluationFunction eval, const State& s, SearchStats *stats)
+{
+    Clock::time_point start = Clock::now();
+    if (s.is_tie_game()) {
+        return finish(start, { eval(s), 0 });
+    }
+    Result book;
+    if (find_book_move(s, &book)) {
+        return finish(start, book);
+    }
+    auto immediate = s.find_immediate_win();
+    if (immediate.is_forced) {
+        return finish(start, { INT_MAX, immediate.move });
+    }
+    ProvenWin win = prove_forced_win(s);
+    if (win.is_proven) {
+        return finish(start, { INT_MAX, win.move });
+    }
+
+    Clock::duration target = allocate(s);
+    Clock::duration hard_limit = std::min(3 * target, remaining_);
+    if (s.must_respond_to_threat().is_forced) {
+        // There's only one move worth searching; the search just scores it.
+        target = target / 4;
+        hard_limit = target;
+    }
+
+    // Deepen while the iterations are cheap, to find out whether the value
+    // is proven, or the tree exhausted, or the best move settled.
+    Result best = { INT_MIN, 0 };
+    int completed_plies = 0;
+    int stable_iterations = 0;
+    long prev_nodes = 0;
+    int plies;
+    for (plies = 1; true; ++plies) {
+        Clock::time_point iteration_start = Clock::now();
+        SearchStats iteration;
+        bool finished = false;
+        Result r = evaluate_to_depth(eval, s, plies, start + target / 2, &finished, &iteration);
+        if (stats != nullptr) {
+            stats->nodes += iteration.nodes;
+            stats->depth = std::max(stats->depth, finished ? plies : plies - 1);
+            stats->peak_live_nodes = std::max(stats->peak_live_nodes, iteration.peak_live_nodes);
+        }
+        if (!finished) {
+            if (plies == 1) {
+                best = r;
+            }
+            break;
+        }
+        stable_iterations = (plies > 1 && r.second == best.second) ? stable_iterations + 1 : 0;
+        best = r;
+        completed_plies = plies;
+        bool is_proven = (r.first >= double(INT_MAX) || r.first <= double(INT_MIN));
+        if (is_proven || iteration.nodes == prev_nodes) {
+            return finish(start, best);  // deeper searches can't change anything
+        }
+        double growth = (prev_nodes != 0) ? double(iteration.nodes) / prev_nodes : 2.0;
+        Clock::time_point now = Clock::now();
+        if ((now - start) + (now - iteration_start) * growth > target / 4) {
+            break;
+        }
+        prev_nodes = iteration.nodes;
+    }
+
+    // Then spend the rest of the time on an open-ended search, as the timed
+    // search does: less of it on a settled best move, more on a new one.
+    Clock::duration soft_limit = target;
+    if (plies == 1) {
+        soft_limit = target;  // nothing to go on
+    } else if (stable_iterations >= 2) {
+        soft_limit = target / 2;
+    } else if (stable_iterations == 0) {
+        soft_limit = std::min(target * 3 / 2, hard_limit);
+    }
+    if (Clock::now() < start + soft_limit) {
+        SearchStats open_ended;
+        bool finished = false;
+        Result r = evaluate_to_depth(eval, s, 0, start + soft_limit, &finished, &open_ended);
+        if (finished || open_ended.depth > completed_plies) {
+            best = r;  // or else it got no deeper than the iterations did
+        }
+        if (stats != nullptr) {
+            stats->nodes += open_ended.nodes;
+            stats->depth = std::max(stats->depth, open_ended.depth);
+            stats->peak_live_nodes = std::max(stats->peak_live_nodes, open_ended.peak_live_nodes);
+        }
+    }
+    return finish(start, best);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "ab-timed.h"
+#include "state.h"
+#include <chrono>
+#include <utility>
+
+// Spends one player's thinking time for a whole game, instead of a fixed
+// budget per move. Each move gets a share of what's left, by how many more
+// moves the player may have to make (one per unseen card) and how many
+// moves there are to choose from. The search deepens one ply at a time,
+// and stops early when the value is proven, when the tree is exhausted,
+// or when the best move has been stable for a while; a best move that
+// keeps changing gets extra time. A book move or an immediate win is
+// played at once, and a forced block gets only a quarter share.
+//
+// Use a new TimeManager for each player in each game.
+
+class TimeManager {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit TimeManager(std::chrono::milliseconds per_game) : remaining_(per_game) {}
+
+    std::pair<double, int> evaluate(LeafEvaluationFunction eval, const State& s, SearchStats *stats = nullptr);
+
+    Clock::duration used() const { return used_; }
+    Clock::duration remaining() const { return remaining_; }
+
+private:
+    Clock::duration allocate(const State& s) const;
+    std::pair<double, int> finish(Clock::time_point start, std::pair<double, int> result);
+
+    Clock::duration remaining_;
+    Clock::duration used_ {0};
+};
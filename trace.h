@@ -0,0 +1,123 @@
+#pragma once
+
+// A timeline of what the search's threads are doing, for chrome://tracing
+// or ui.perfetto.dev. Build with `make TRACING=1 ...` (which defines
+// CONNECT15_TRACING) to turn it on; otherwise every TRACE_ macro expands
+// to nothing, and none of this is compiled at all.
+//
+// Each thread records into its own fixed-size ring buffer, so recording
+// takes no locks and never allocates; when a buffer wraps around, the
+// oldest events are lost. TRACE_DUMP writes out all the threads' events,
+// so call it only while nothing is recording, e.g. after a search.
+
+#ifndef CONNECT15_TRACING
+#define CONNECT15_TRACING 0
+#endif
+
+#if CONNECT15_TRACING
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+namespace trace {
+
+struct Event {
+    const char *name;  // always a string literal
+    char phase;        // 'B'egin, 'E'nd, or 'i'nstant, as in the trace-event format
+    int64_t ns;
+};
+
+struct ThreadBuffer {
+    static constexpr int capacity = 1 << 16;
+    int tid;
+    std::atomic<uint64_t> count {0};
+    Event events[capacity];
+};
+
+struct Registry {
+    std::mutex mtx;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+};
+
+inline Registry& registry() {
+    static Registry r;
+    return r;
+}
+
+inline ThreadBuffer& this_thread_buffer() {
+    static thread_local ThreadBuffer *buffer = []() {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lk(r.mtx);
+        r.buffers.push_back(std::make_unique<ThreadBuffer>());
+        r.buffers.back()->tid = r.buffers.size();
+        return r.buffers.back().get();
+    }();
+    return *buffer;
+}
+
+inline void record(const char *name, char phase) {
+    ThreadBuffer& b = this_thread_buffer();
+    uint64_t i = b.count.load(std::memory_order_relaxed);
+    b.events[i % ThreadBuffer::capacity] = Event{
+        name, phase, (std::chrono::steady_clock::now() - registry().epoch) / std::chrono::nanoseconds(1)
+    };
+    b.count.store(i + 1, std::memory_order_release);
+}
+
+struct Scope {
+    const char *name_;
+    explicit Scope(const char *name) : name_(name) { record(name_, 'B'); }
+    ~Scope() { record(name_, 'E'); }
+};
+
+// Writes the events in the trace-event JSON format, and forgets them.
+inline bool dump(const char *filename) {
+    FILE *fp = fopen(filename, "w");
+    if (fp == nullptr) {
+        return false;
+    }
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lk(r.mtx);
+    fprintf(fp, "{\"traceEvents\": [\n");
+    const char *sep = "";
+    for (auto&& b : r.buffers) {
+        uint64_t end = b->count.load(std::memory_order_acquire);
+        uint64_t begin = (end > ThreadBuffer::capacity) ? end - ThreadBuffer::capacity : 0;
+        for (uint64_t i = begin; i < end; ++i) {
+            const Event& e = b->events[i % ThreadBuffer::capacity];
+            fprintf(fp, "%s{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d%s}",
+                    sep, e.name, e.phase, e.ns / 1000.0, b->tid, (e.phase == 'i') ? ", \"s\": \"t\"" : "");
+            sep = ",\n";
+        }
+        b->count.store(0, std::memory_order_relaxed);
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    return true;
+}
+
+} // namespace trace
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_BEGIN(name) trace::record(name, 'B')
+#define TRACE_END(name) trace::record(name, 'E')
+#define TRACE_INSTANT(name) trace::record(name, 'i')
+#define TRACE_DUMP(filename) trace::dump(filename)
+
+#else
+
+#define TRACE_SCOPE(name) do {} while (0)
+#define TRACE_BEGIN(name) do {} while (0)
+#define TRACE_END(name) do {} while (0)
+#define TRACE_INSTANT(name) do {} while (0)
+#define TRACE_DUMP(filename) false
+
+#endif
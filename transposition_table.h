@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <memory>
+#include <stdint.h>
+#include <string.h>
+
+// A position cache that any number of threads can read and write at once,
+// without locks, for the Lazy SMP search (see ab.h). Each slot is two
+// atomic words, the entry and the entry XORed with its key, so that a
+// slot torn by two threads writing it at once just fails to match any
+// key, and is ignored. Keys are hashes of the canonical PackedState, and
+// moves are stored for the canonical orientation, as in the matchboxes.
+// A collision of the 64-bit hashes goes undetected; that's very rare.
+
+class TranspositionTable {
+public:
+    struct Entry {
+        double value;
+        int move;   // -1 through GameRules::max_cards
+        int depth;  // in plies, at least 1
+    };
+
+    explicit TranspositionTable(int log2_slots) :
+        slots_(new Slot[size_t(1) << log2_slots]), mask_((uint64_t(1) << log2_slots) - 1) {}
+
+    bool probe(uint64_t key, Entry *e) const {
+        const Slot& slot = slots_[key & mask_];
+        uint64_t data = slot.data_.load(std::memory_order_relaxed);
+        uint64_t check = slot.check_.load(std::memory_order_relaxed);
+        if ((check ^ data) != key || data == 0) {
+            return false;
+        }
+        uint32_t bits = uint32_t(data);
+        float value;
+        memcpy(&value, &bits, 4);
+        // A float can't hold INT_MAX exactly; keep proven wins recognizable.
+        e->value = (value >= float(INT_MAX)) ? double(INT_MAX) : (value <= float(INT_MIN)) ? double(INT_MIN) : double(value);
+        e->depth = int((data >> 32) & 0xFF);
+        e->move = int((data >> 40) & 0xFF) - 1;
+        return true;
+    }
+
+    // Keeps a deeper entry for the same position.
+    void store(uint64_t key, const Entry& e) {
+        Entry old;
+        if (probe(key, &old) && old.depth > e.depth) {
+            return;
+        }
+        float value = e.value;
+        uint32_t bits;
+        memcpy(&bits, &value, 4);
+        uint64_t data = bits | (uint64_t(e.depth & 0xFF) << 32) | (uint64_t(e.move + 1) << 40);
+        Slot& slot = slots_[key & mask_];
+        slot.data_.store(data, std::memory_order_relaxed);
+        slot.check_.store(key ^ data, std::memory_order_relaxed);
+    }
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> check_ {0};
+        std::atomic<uint64_t> data_ {0};
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    uint64_t mask_;
+};